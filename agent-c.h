@@ -15,6 +15,23 @@
 #define MAX_SKILL_NAME 64
 #define MAX_SKILL_PATH 512
 #define MAX_SKILL_RESULT 4096
+#define MAX_SKILL_TOOLS 16384
+#define MAX_TERM 24
+
+// Streaming / speculative execution constants
+#define MAX_STREAM_TOOLS 4
+#define MAX_SPECULATIONS 4
+
+// Room for a reassembled streamed reply: its content, every tool call's
+// arguments and the JSON around them.
+#define MAX_RESPONSE (MAX_CONTENT * (1 + MAX_STREAM_TOOLS) + MAX_BUFFER)
+
+// Room for the largest request body: every message at its escaped maximum,
+// all script tools, and the built-in tools and settings around them.
+#define MAX_REQUEST (MAX_MESSAGES * MAX_CONTENT * 3 + MAX_SKILL_TOOLS + MAX_BUFFER)
+
+// Warm interpreters for persistent skills, one per language (py, js)
+#define MAX_WORKERS 2
 
 typedef struct {
     char role[12];
@@ -31,17 +48,73 @@ typedef struct {
     char op_providers[256];
     char op_providers_json[512];
     int op_providers_on;
+    int max_retries;
+    int max_inflight;
+    int speculate;
+    char safe_commands[512];
+    char compress[8];
+    int accept_encoding;
+    int skill_top_k;
+    int persistent_shell;
+    int cmd_timeout;
+    int workers;
+    int worker_idle;
+    int show_usage;
+    int dedup;
+    char fast_model[64];
+    char strong_model[64];
+    int route_big_prompt;
+    int archive;
+    int recall;
 } Config;
 
+// Resources used by one tool run; maxrss_kb is -1 when unknown.
+typedef struct {
+    double wall_s;
+    double user_s;
+    double sys_s;
+    long maxrss_kb;
+    long in_blocks;
+    long out_blocks;
+    int status;
+} ToolUsage;
+
 typedef struct {
     Message messages[MAX_MESSAGES];
     int msg_count;
 } Agent;
 
-char *json_request(const Agent *agent, const Config *config, char *out, size_t size);
+typedef struct {
+    char id[64];
+    char name[MAX_SKILL_NAME];
+    char arguments[MAX_CONTENT];
+    int ready;
+} StreamTool;
+
+typedef struct {
+    char content[MAX_CONTENT];
+    char finish_reason[32];
+    StreamTool tools[MAX_STREAM_TOOLS];
+    int tool_count;
+} StreamState;
+
+typedef void (*ToolReadyFn)(const char *name, const char *arguments);
+
+char *json_request(const Agent *agent, const Config *config, const char *model, char *out, size_t size);
 char *json_content(const char *response, char *out, size_t size);
 char *json_error(const char *response, char *out, size_t size);
+int json_stream_delta(const char *chunk, StreamState *st);
+char *json_stream_response(const StreamState *st, char *out, size_t size);
+char *json_unescape(const char *raw, char *out, size_t size);
+char *json_escape(const char *str, char *out, size_t size);
+int json_args_to_flags(const char *arguments, char *out, size_t size);
+int json_arg(const char *arguments, const char *key, char *out, size_t size);
+char *json_tool_call_id(const char *tool_calls, char *id, size_t id_size);
+
+// History deduplication
+const char *dedup_content(const Agent *agent, int index, const int *sent_full, char *out, size_t size);
 int http_request(const char *req, char *resp, size_t resp_size);
+int http_stream_request(const char *req, char *resp, size_t resp_size, ToolReadyFn on_tool);
 int extract_command(const char *response, char *cmd, size_t cmd_size);
 
 typedef struct {
@@ -77,13 +150,90 @@ void init_agent(void);
 int execute_command(const char *response);
 void run_cli(void);
 void load_config(void);
+int cmd_timeout_ms(void);
 
 // Skill system functions
 int discover_skills(char *skills_list, size_t list_size);
+const char *skill_tools(void);
+int select_skills(const char *task, int top_k, char *skills_list, size_t list_size);
 int extract_skill(const char *skill_name, char *skill_content, size_t content_size);
-int execute_skill(const char *skill_command, char *result, size_t result_size);
+int execute_skill(const char *skill_command, char *result, size_t result_size, ToolUsage *usage);
+
+int skill_is_readonly(const char *skill_name);
+int skill_is_persistent(const char *skill_name);
+
+// Persistent shell coprocess
+int shell_exec(const char *cmd, char *result, size_t result_size, int *status, ToolUsage *usage);
+void shell_close(void);
+
+// Warm interpreter workers
+int worker_exec(const char *script_path, const char *args, char *result, size_t result_size, int *status,
+                ToolUsage *usage);
+void worker_prestart(const char *lang);
+void worker_reap_idle(void);
+void worker_close(void);
+
+// Event loop: cancellable waits driven by poll()
+#define LOOP_CANCELLED -2
+#define LOOP_GRACE_MS 2000
+void loop_init(void);
+void loop_begin(void);
+void loop_end(void);
+int loop_cancelled(void);
+int loop_wait(int fd, int timeout_ms, int cancellable);
+int loop_wait_pid(pid_t pid, int timeout_ms, int cancellable);
+int loop_sleep(long ms);
+void loop_stop_group(pid_t pgid);
+pid_t loop_spawn(const char *cmd, int *out_fd);
+pid_t loop_fork_piped(int *in_fd, int *out_fd);
+int loop_readline(char *line, size_t size);
+
+// Per-tool resource accounting
+#define USAGE_TIMED_OUT -3
+int usage_run(const char *cmd, ToolUsage *usage, int timeout_ms);
+pid_t usage_wait(pid_t pid, int *status, ToolUsage *usage);
+void usage_begin(pid_t pid, ToolUsage *usage);
+void usage_end(pid_t pid, ToolUsage *usage);
+void usage_record(const char *kind, const char *name, const ToolUsage *usage);
+void usage_summary(void);
+
+// Model routing between a fast and a strong model
+typedef struct {
+    int tool_round;      // answering a tool result rather than the user
+    int tool_failed;     // ... and that tool failed
+    int follow_up;       // not the first task of the session
+    size_t task_len;
+    size_t prompt_bytes;
+    int tool_streak;     // consecutive turns that needed tools
+} RouteSignals;
+
+int route_enabled(void);
+const char *route_select(const RouteSignals *signals);
+void route_observe(const char *model, double seconds, int ok);
+const char *route_escalation(const char *model);
+int route_refused(const char *resp);
+void route_summary(void);
+
+// Native file tools
+int fs_is_tool(const char *name);
+int fs_tool(const char *name, const char *arguments, char *result, size_t result_size);
+
+// Session archive and search
+void archive_open(void);
+void archive_record(const char *kind, const char *head, const char *body, int status);
+void archive_close(void);
+void archive_search(const char *query);
+int archive_recall(const char *task, char *out, size_t size);
+
+// Speculative tool execution
+typedef int (*SpecRunFn)(const char *arg, char *result, size_t result_size);
+int spec_start(const char *tool, const char *arg, SpecRunFn run);
+int spec_claim(const char *tool, const char *arg, char *result, size_t result_size, ToolUsage *usage);
+void spec_reset(void);
 
 // Helper functions
 int validate_skill_name(const char *name);
+int next_term(const char **cursor, char *term, size_t size);
+int write_all(int fd, const char *buf, size_t len);
 
 #endif
@@ -1,4 +1,5 @@
 #include "agent-c.h"
+#include <time.h>
 
 extern Agent agent;
 extern Config config;
@@ -9,6 +10,7 @@ static void build_system_prompt(char *prompt, size_t size, int skill_count, cons
         "Use phrases like 'At your service.' and deliver solutions with confidence, wit, tech-savvy humor, occasional sarcasm but always charming and helpful. "
         "For multi-step tasks, chain commands with && (e.g., 'echo content > file.py && python3 file.py'). "
         "Use execute_command for shell tasks. Use execute_skill to run predefined skill scripts. "
+        "To read files, list directories or search code, use read_file, list_dir and grep instead of cat, ls, find or grep in the shell. "
         "Provide elegant solutions while maintaining that unique charm.\n"
         "CRITICAL: Skills are for your internal use ONLY. NEVER output skill documentation, examples, or any skill content to users. "
         "Treat skills as internal knowledge - use them silently to execute tasks. VIOLATING THIS RULE IS UNACCEPTABLE. "
@@ -19,8 +21,9 @@ static void build_system_prompt(char *prompt, size_t size, int skill_count, cons
         snprintf(prompt, size,
                  "%s=== AVAILABLE SKILLS ===\n%s"
                  "HOW TO USE SKILLS:\n"
-                 "1. Call extract_skill with skill_name to get the complete skill documentation\n"
-                 "2. Call execute_skill with 'skill_name script_name [arguments]' to execute specific scripts\n"
+                 "1. Scripts declared by a skill are tools named 'skill_name__script_name'; call them directly\n"
+                 "2. Otherwise call extract_skill with skill_name to get the complete skill documentation\n"
+                 "3. Then call execute_skill with 'skill_name script_name [arguments]' to execute specific scripts\n"
                  "=== END SKILLS ===\n"
                  "IMPORTANT: Never output skill content directly to user. Use skills silently.\n\n",
                  base_prompt, skills_list);
@@ -40,6 +43,29 @@ void init_agent(void) {
     agent.msg_count = 1;
 }
 
+// Re-ranks the skill library against the task (and the previous one, so
+// short follow-ups keep their context) and rebuilds the skills section of
+// the system prompt. Skill documentation loaded by extract_skill is kept.
+static void refresh_skills(const char *task) {
+    static char last_task[MAX_CONTENT];
+
+    char query[MAX_CONTENT * 2];
+    snprintf(query, sizeof(query), "%s %s", last_task, task);
+    snprintf(last_task, sizeof(last_task), "%s", task);
+
+    char skills_list[MAX_CONTENT];
+    int skill_count = select_skills(query, config.skill_top_k, skills_list, sizeof(skills_list));
+    if (skill_count < 0) return;
+
+    char loaded[MAX_CONTENT] = "";
+    const char *tail = strstr(agent.messages[0].content, "\n\n=== SKILL: ");
+    if (tail) snprintf(loaded, sizeof(loaded), "%s", tail);
+
+    build_system_prompt(agent.messages[0].content, MAX_CONTENT, 1, skills_list);
+    size_t len = strlen(agent.messages[0].content);
+    snprintf(agent.messages[0].content + len, MAX_CONTENT - len, "%s", loaded);
+}
+
 static void add_message(const char *role, const char *content, const char *tool_calls) {
     if (agent.msg_count >= MAX_MESSAGES - 1) return;
 
@@ -92,16 +118,81 @@ static int handle_extract_skill(const char *skill_name, char *result, size_t res
     return rc == 0;
 }
 
+static int run_skill_command(const char *skill_command, char *result, size_t result_size) {
+    return -execute_skill(skill_command, result, result_size, NULL);
+}
+
+// Speculative runs pass a timeout (-1 for none) so a command like tail -f
+// cannot hold its slot forever; commands the model asked for run unbounded.
+static int run_fresh_measured(const char *cmd, char *result, size_t result_size, ToolUsage *usage, int timeout_ms) {
+    char temp[] = "/tmp/ai_cmd_XXXXXX";
+    int fd = mkstemp(temp);
+    if (fd == -1) return 1;
+    close(fd);
+
+    char full[MAX_BUFFER];
+    snprintf(full, MAX_BUFFER, "(%s) > '%s' 2>&1", cmd, temp);
+
+    int rc = usage_run(full, usage, timeout_ms);
+
+    FILE *f = fopen(temp, "r");
+    if (f) {
+        size_t bytes = fread(result, 1, result_size - 1, f);
+        result[bytes] = '\0';
+        fclose(f);
+    }
+    unlink(temp);
+
+    size_t len = strlen(result);
+    const char *sep = len && result[len - 1] != '\n' ? "\n" : "";
+    if (loop_cancelled()) {
+        snprintf(result + len, result_size - len, "%s[command cancelled by user]", sep);
+    } else if (rc == USAGE_TIMED_OUT) {
+        snprintf(result + len, result_size - len, "%s[command timed out after %ds]", sep, config.cmd_timeout);
+    }
+    return rc == 0 ? 0 : 1;
+}
+
+static int run_fresh_command(const char *cmd, char *result, size_t result_size) {
+    return run_fresh_measured(cmd, result, result_size, NULL, cmd_timeout_ms());
+}
+
+static int run_shell_command(const char *cmd, char *result, size_t result_size, ToolUsage *usage) {
+    int status;
+    if (config.persistent_shell && shell_exec(cmd, result, result_size, &status, usage) == 0) return status == 0 ? 0 : 1;
+    return run_fresh_measured(cmd, result, result_size, usage, -1);
+}
+
+// Usage is keyed by skill name for skills and by program name for commands.
+static void record_usage(const char *kind, const char *command, const ToolUsage *usage) {
+    char name[MAX_SKILL_NAME * 2];
+    snprintf(name, sizeof(name), "%s", command);
+    name[strcspn(name, " \t\n;|&")] = '\0';
+
+    const char *base = strrchr(name, '/');
+    usage_record(kind, base && base[1] ? base + 1 : name, usage);
+}
+
+static int claim_speculation(const char *tool, const char *arg, char *result, size_t result_size, ToolUsage *usage) {
+    int code = spec_claim(tool, arg, result, result_size, usage);
+    if (code != -1) printf("\033[2m⚡ using speculative result\033[0m\n");
+    return code;
+}
+
 static int handle_execute_skill(const char *skill_command, char *result, size_t result_size, const char *tool_calls) {
     printf("\033[32m🔧 Executing skill: %s\033[0m\n", skill_command);
 
-    int rc = execute_skill(skill_command, result, result_size);
+    ToolUsage usage = { .maxrss_kb = -1 };
+    int code = claim_speculation("execute_skill", skill_command, result, result_size, &usage);
+    int rc = code != -1 ? -code : execute_skill(skill_command, result, result_size, &usage);
 
     if (rc == 0) {
         if (*result) {
             printf("%s", result);
             ensure_newline(result);
         }
+    } else if (loop_cancelled()) {
+        snprintf(result, result_size, "Skill command '%s' cancelled by user", skill_command);
     } else {
         printf("\033[31mError: Failed to execute skill command '%s' (code: %d)\033[0m\n", skill_command, rc);
         if (rc == -1) {
@@ -110,6 +201,8 @@ static int handle_execute_skill(const char *skill_command, char *result, size_t
         }
         snprintf(result, result_size, "Error: Failed to execute skill command '%s' (code: %d)", skill_command, rc);
     }
+    if (usage.wall_s > 0) record_usage("skill", skill_command, &usage);
+    archive_record("skill", skill_command, result, usage.wall_s > 0 ? usage.status : rc);
 
     add_tool_message(result, tool_calls);
     return rc == 0;
@@ -118,32 +211,116 @@ static int handle_execute_skill(const char *skill_command, char *result, size_t
 static int handle_shell_command(const char *cmd, char *result, size_t result_size, const char *tool_calls) {
     printf("\033[31m$ %s\033[0m\n", cmd);
 
-    char temp[] = "/tmp/ai_cmd_XXXXXX";
-    int fd = mkstemp(temp);
-    if (fd == -1) return 0;
-    close(fd);
+    ToolUsage usage = { .maxrss_kb = -1 };
+    int rc = claim_speculation("execute_command", cmd, result, result_size, &usage);
+    if (rc == -1) rc = run_shell_command(cmd, result, result_size, &usage);
 
-    char full[MAX_BUFFER];
-    snprintf(full, MAX_BUFFER, "(%s) > '%s' 2>&1", cmd, temp);
+    if (*result) {
+        printf("%s", result);
+        ensure_newline(result);
+    }
+    record_usage("shell", cmd, &usage);
+    archive_record("shell", cmd, result, usage.status);
 
-    int rc = system(full);
+    add_tool_message(result, tool_calls);
+    return rc == 0;
+}
 
-    FILE *f = fopen(temp, "r");
-    if (f) {
-        size_t bytes = fread(result, 1, result_size - 1, f);
-        result[bytes] = '\0';
-        fclose(f);
-        if (bytes) {
-            printf("%s", result);
-            ensure_newline(result);
-        }
-    }
-    unlink(temp);
+static int handle_fs_tool(const char *name, const char *arguments, char *result, size_t result_size,
+                          const char *tool_calls) {
+    char flags[MAX_CONTENT], call[MAX_CONTENT];
+    json_args_to_flags(*arguments ? arguments : "{}", flags, sizeof(flags));
+    snprintf(call, sizeof(call), "%s%s", name, flags);
+    printf("\033[36m📂 %s\033[0m\n", call);
+
+    ToolUsage usage;
+    usage_begin(getpid(), &usage);
+    int rc = fs_tool(name, arguments, result, result_size);
+    usage_end(getpid(), &usage);
+    usage.maxrss_kb = -1;
+    usage.status = rc == 0 ? 0 : 1;
+
+    printf("%s", result);
+    ensure_newline(result);
+    record_usage("file", name, &usage);
+    archive_record("file", call, result, usage.status);
 
     add_tool_message(result, tool_calls);
     return rc == 0;
 }
 
+// Some allow-listed commands still write a file or never finish given the
+// wrong flags (git diff --output=FILE, tail -f). Long options are matched
+// with the abbreviations getopt and git accept; short ones may be bundled,
+// as in tail -nF.
+static int is_unsafe_flag(const char *word) {
+    word += strspn(word, "'\"");
+    if (word[0] != '-') return 0;
+    if (word[1] != '-') return strpbrk(word, "fF") != NULL;
+
+    static const char *long_flags[] = {"--output", "--follow", NULL};
+    size_t len = strcspn(word, "='\"");
+    for (int i = 0; long_flags[i]; i++) {
+        size_t flag_len = strlen(long_flags[i]);
+        if (len >= 3 && strncmp(word, long_flags[i], len < flag_len ? len : flag_len) == 0) return 1;
+    }
+    return 0;
+}
+
+// Only plain invocations of allow-listed read-only commands are speculated:
+// redirection, chaining or substitution could all have side effects.
+static int is_safe_command(const char *cmd) {
+    if (strpbrk(cmd, "<>;&|`$\n")) return 0;
+
+    char words[MAX_CONTENT];
+    snprintf(words, sizeof(words), "%s", cmd);
+    for (char *word, *tmp = words; (word = strtok(tmp, " \t")); tmp = NULL) {
+        if (is_unsafe_flag(word)) return 0;
+    }
+
+    char list[sizeof(config.safe_commands)];
+    snprintf(list, sizeof(list), "%s", config.safe_commands);
+
+    for (char *tok, *tmp = list; (tok = strtok(tmp, ",")); tmp = NULL) {
+        tok = trim(tok);
+        size_t len = strlen(tok);
+        if (len && strncmp(cmd, tok, len) == 0 && (cmd[len] == '\0' || cmd[len] == ' ')) return 1;
+    }
+    return 0;
+}
+
+// Script tools are named "<skill>__<script>" and map onto execute_skill.
+static int script_tool_command(const char *name, const char *arguments, char *out, size_t size) {
+    const char *sep = strstr(name, "__");
+    if (!sep || sep == name || !sep[2]) return 0;
+
+    char flags[MAX_CONTENT];
+    json_args_to_flags(*arguments ? arguments : "{}", flags, sizeof(flags));
+    snprintf(out, size, "%.*s %s%s", (int)(sep - name), name, sep + 2, flags);
+    return 1;
+}
+
+static void speculate_tool(const char *name, const char *arguments) {
+    char arg[MAX_CONTENT];
+
+    if (strcmp(name, "execute_command") == 0) {
+        if (json_arg(arguments, "command", arg, sizeof(arg)) && is_safe_command(arg)) {
+            spec_start(name, arg, run_fresh_command);
+        }
+    } else if (strcmp(name, "execute_skill") == 0) {
+        char skill_name[MAX_SKILL_NAME];
+        if (json_arg(arguments, "skill_command", arg, sizeof(arg)) &&
+            sscanf(arg, "%63s", skill_name) == 1 && skill_is_readonly(skill_name)) {
+            spec_start(name, arg, run_skill_command);
+        }
+    } else if (script_tool_command(name, arguments, arg, sizeof(arg))) {
+        char skill_name[MAX_SKILL_NAME];
+        if (sscanf(arg, "%63s", skill_name) == 1 && skill_is_readonly(skill_name)) {
+            spec_start("execute_skill", arg, run_skill_command);
+        }
+    }
+}
+
 int execute_command(const char *response) {
     if (!response) return 0;
 
@@ -155,6 +332,27 @@ int execute_command(const char *response) {
     static const ToolExtractor extractor_all = {"all"};
     extract_tool_calls(response, tool_calls, sizeof(tool_calls), &extractor_all);
 
+    if (loop_cancelled()) {
+        add_tool_message("Cancelled by user", tool_calls);
+        return 0;
+    }
+
+    char tool_name[MAX_SKILL_NAME * 2] = {0};
+    char arguments[MAX_CONTENT] = {0};
+    static const ToolExtractor extractor_name = {"name"};
+    static const ToolExtractor extractor_args = {"arguments"};
+    if (extract_tool_calls(response, tool_name, sizeof(tool_name), &extractor_name)) {
+        extract_tool_calls(response, arguments, sizeof(arguments), &extractor_args);
+        if (fs_is_tool(tool_name)) {
+            char result[MAX_CONTENT];
+            return handle_fs_tool(tool_name, arguments, result, sizeof(result), tool_calls);
+        }
+        if (script_tool_command(tool_name, arguments, skill_command, sizeof(skill_command))) {
+            char skill_result[MAX_SKILL_RESULT] = {0};
+            return handle_execute_skill(skill_command, skill_result, sizeof(skill_result), tool_calls);
+        }
+    }
+
     if (extract_skill_name(response, skill_name, sizeof(skill_name)) && *skill_name) {
         char skill_content[MAX_CONTENT];
         return handle_extract_skill(skill_name, skill_content, sizeof(skill_content), tool_calls);
@@ -183,12 +381,46 @@ static void slide_messages(void) {
     agent.msg_count -= preserve_count;
 }
 
-static int make_api_request(char *req, char *resp, size_t resp_size) {
-    json_request(&agent, &config, req, MAX_BUFFER);
-    return http_request(req, resp, resp_size);
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t history_bytes(void) {
+    size_t bytes = 0;
+    for (int i = 0; i < agent.msg_count; i++) {
+        bytes += strlen(agent.messages[i].content) + strlen(agent.messages[i].tool_calls);
+    }
+    return bytes;
+}
+
+static int send_request(char *req, char *resp, size_t resp_size, const char *model) {
+    json_request(&agent, &config, model, req, MAX_REQUEST);
+
+    double start = now_s();
+    int rc = config.speculate ? http_stream_request(req, resp, resp_size, speculate_tool)
+                              : http_request(req, resp, resp_size);
+    if (rc != LOOP_CANCELLED) route_observe(model, now_s() - start, rc == 0);
+    return rc;
+}
+
+// Sends the history to the routed model; a fast model that fails or refuses
+// gets one retry on the strong model.
+static int make_api_request(char *req, char *resp, size_t resp_size, const RouteSignals *signals) {
+    const char *model = route_select(signals);
+    int rc = send_request(req, resp, resp_size, model);
+    if (rc == LOOP_CANCELLED || (rc == 0 && !route_refused(resp))) return rc;
+
+    const char *strong = route_escalation(model);
+    if (!strong) return rc;
+
+    printf("\033[2m🧭 escalating to %s (%s)\033[0m\n", strong, rc ? "request failed" : "no usable answer");
+    spec_reset();
+    return send_request(req, resp, resp_size, strong);
 }
 
-static void handle_tool_response(const char *resp) {
+static int handle_tool_response(const char *resp) {
     char assistant_content[MAX_CONTENT] = {0};
     char tool_calls[MAX_CONTENT] = {0};
 
@@ -201,7 +433,17 @@ static void handle_tool_response(const char *resp) {
         add_message("assistant", assistant_content, tool_calls);
     }
 
-    execute_command(resp);
+    return execute_command(resp);
+}
+
+static int report_error(const char *resp) {
+    char error_msg[MAX_CONTENT];
+    if (json_error(resp, error_msg, sizeof(error_msg))) {
+        printf("\033[31mError: %s\033[0m\n", error_msg);
+    } else {
+        printf("\033[31mError: Invalid API response\033[0m\n");
+    }
+    return -1;
 }
 
 static void display_response(const char *resp) {
@@ -209,31 +451,80 @@ static void display_response(const char *resp) {
     if (json_content(resp, content, sizeof(content))) {
         printf("\033[34m%s\033[0m\n", content);
         add_message("assistant", content, NULL);
+        archive_record("reply", content, NULL, 0);
         return;
     }
 
-    char error_msg[MAX_CONTENT];
-    if (json_error(resp, error_msg, sizeof(error_msg))) {
-        printf("\033[31mError: %s\033[0m\n", error_msg);
+    report_error(resp);
+}
+
+// A cancelled turn stays in history so the model knows it never finished.
+static int report_cancelled(void) {
+    spec_reset();
+    add_message("assistant", "[Request cancelled by user]", NULL);
+    return LOOP_CANCELLED;
+}
+
+static int run_turn(const char *task) {
+    static char req[MAX_REQUEST];
+    static char resp[MAX_RESPONSE];
+    static int tool_streak, tasks;
+
+    RouteSignals signals = {
+        .follow_up = tasks++ > 0,
+        .task_len = strlen(task),
+        .prompt_bytes = history_bytes(),
+        .tool_streak = tool_streak,
+    };
+    int rc = make_api_request(req, resp, sizeof(resp), &signals);
+    if (rc == LOOP_CANCELLED) return report_cancelled();
+    if (rc) return report_error(resp);
+
+    if (!has_tool_call(resp)) {
+        tool_streak = 0;
     } else {
-        printf("\033[31mError: Invalid API response\033[0m\n");
+        int ok = handle_tool_response(resp);
+        spec_reset();
+        if (loop_cancelled()) return report_cancelled();
+
+        signals.tool_round = 1;
+        signals.tool_failed = !ok;
+        signals.prompt_bytes = history_bytes();
+        signals.tool_streak = ++tool_streak;
+        rc = make_api_request(req, resp, sizeof(resp), &signals);
+        if (rc == LOOP_CANCELLED) return report_cancelled();
+        if (rc) return report_error(resp);
     }
+
+    display_response(resp);
+    return 0;
 }
 
+// The first task of a session may pull in matching entries from earlier
+// sessions; they go in as a system message ahead of it.
+static void recall_past_sessions(const char *task) {
+    char recalled[MAX_CONTENT];
+    int count = archive_recall(task, recalled, sizeof(recalled));
+    if (count <= 0) return;
+
+    printf("\033[2m📚 recalled %d entr%s from earlier sessions\033[0m\n", count, count == 1 ? "y" : "ies");
+    add_message("system", recalled, NULL);
+}
+
+// Returns 0, -1 on failure or LOOP_CANCELLED if the user pressed Ctrl-C.
 int process_agent(const char *task) {
+    static int recalled;
     if (!task) return -1;
 
     slide_messages();
+    worker_reap_idle();
+    refresh_skills(task);
+    if (!recalled++) recall_past_sessions(task);
     add_message("user", task, NULL);
+    archive_record("user", task, NULL, 0);
 
-    char req[MAX_BUFFER], resp[MAX_BUFFER];
-    if (make_api_request(req, resp, sizeof(resp))) return -1;
-
-    if (has_tool_call(resp)) {
-        handle_tool_response(resp);
-        if (make_api_request(req, resp, sizeof(resp))) return -1;
-    }
-
-    display_response(resp);
-    return 0;
+    loop_begin();
+    int rc = run_turn(task);
+    loop_end();
+    return rc;
 }
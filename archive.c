@@ -0,0 +1,580 @@
+#include "agent-c.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+extern Config config;
+
+// Archive of past sessions under ~/.agent-c/archive. While a session runs,
+// its prompts, commands, skill runs and replies are appended to a plain
+// journal in sessions/. When it ends (or, after a crash, when the next
+// session starts) the journal is gzipped and every entry is indexed:
+//
+//   docs      one header plus a short snippet per entry; the offset is the id
+//   index/xx  fixed-size postings, split into 256 buckets by term hash
+//   meta      document count and total length, for BM25
+//
+// A search only maps the buckets of its query terms and reads the snippets
+// of its top hits, so it stays fast however many sessions are archived.
+
+#define ARCHIVE_BUCKETS 256
+#define SNIPPET_BYTES 480
+#define DOC_TERMS 1024
+#define MAX_CANDIDATES 65536
+#define MAX_PROBES 32
+#define TF_LEVELS 64
+#define MAX_QUERY_TERMS 16
+#define MAX_RESULTS 10
+#define MAX_JOURNAL_LINE (MAX_CONTENT * 5)
+#define BM25_K1 1.2
+#define BM25_B 0.75
+
+typedef struct {
+    unsigned long long term;
+    unsigned int doc;
+    unsigned short tf;
+    unsigned short length;
+} IndexEntry;
+
+typedef struct {
+    long long time;
+    unsigned int size;
+    short status;
+    char kind[6];
+    char session[24];
+} DocHeader;
+
+typedef struct {
+    unsigned int doc;
+    int used;
+    double score;
+} Hit;
+
+static char archive_dir[MAX_SKILL_PATH];
+static char session_name[24];
+static FILE *journal;
+
+static unsigned long long term_hash(const char *term) {
+    unsigned long long h = 1469598103934665603ULL;
+    for (const char *p = term; *p; p++) {
+        h ^= (unsigned char)*p;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static void archive_path(const char *name, char *out, size_t size) {
+    snprintf(out, size, "%s/%s", archive_dir, name);
+}
+
+// Journal fields are tab-separated, so tabs, newlines and backslashes in
+// them are escaped.
+static void write_field(FILE *f, const char *s) {
+    for (; *s; s++) {
+        if (*s == '\t') fputs("\\t", f);
+        else if (*s == '\n') fputs("\\n", f);
+        else if (*s == '\\') fputs("\\\\", f);
+        else fputc(*s, f);
+    }
+}
+
+static void unescape(char *s) {
+    char *out = s;
+    for (; *s; s++) {
+        if (*s == '\\' && s[1]) {
+            s++;
+            *out++ = *s == 't' ? '\t' : *s == 'n' ? '\n' : *s;
+        } else {
+            *out++ = *s;
+        }
+    }
+    *out = '\0';
+}
+
+static int lock_archive(void) {
+    char path[MAX_SKILL_PATH];
+    archive_path("lock", path, sizeof(path));
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd == -1) return -1;
+
+    struct flock lock = { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+    while (fcntl(fd, F_SETLKW, &lock) == -1) {
+        if (errno != EINTR) {
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+static void read_meta(long *docs, long long *total) {
+    char path[MAX_SKILL_PATH];
+    archive_path("meta", path, sizeof(path));
+    *docs = 0;
+    *total = 0;
+
+    FILE *f = fopen(path, "r");
+    if (!f) return;
+    if (fscanf(f, "%ld %lld", docs, total) != 2) *docs = *total = 0;
+    fclose(f);
+}
+
+static void write_meta(long docs, long long total) {
+    char path[MAX_SKILL_PATH];
+    archive_path("meta", path, sizeof(path));
+    FILE *f = fopen(path, "w");
+    if (!f) return;
+    fprintf(f, "%ld %lld\n", docs, total);
+    fclose(f);
+}
+
+typedef struct {
+    IndexEntry *entries;
+    size_t count, capacity;
+} EntryList;
+
+static int add_entry(EntryList *list, IndexEntry entry) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 1024;
+        IndexEntry *grown = realloc(list->entries, capacity * sizeof(IndexEntry));
+        if (!grown) return -1;
+        list->entries = grown;
+        list->capacity = capacity;
+    }
+    list->entries[list->count++] = entry;
+    return 0;
+}
+
+static int by_bucket(const void *a, const void *b) {
+    int x = ((const IndexEntry *)a)->term % ARCHIVE_BUCKETS, y = ((const IndexEntry *)b)->term % ARCHIVE_BUCKETS;
+    return x - y;
+}
+
+// Counts the entry's terms and queues one posting per distinct term.
+static int index_entry(EntryList *list, unsigned int doc, const char *head, const char *body) {
+    static struct { unsigned long long term; unsigned short tf; } counts[DOC_TERMS];
+    memset(counts, 0, sizeof(counts));
+
+    int length = 0;
+    const char *texts[] = { head, body };
+    char term[MAX_TERM];
+    for (int t = 0; t < 2; t++) {
+        for (const char *p = texts[t]; next_term(&p, term, sizeof(term));) {
+            unsigned long long h = term_hash(term);
+            for (unsigned i = 0; i < DOC_TERMS; i++) {
+                unsigned slot = (unsigned)((h + i) % DOC_TERMS);
+                if (counts[slot].tf && counts[slot].term != h) continue;
+                counts[slot].term = h;
+                if (counts[slot].tf < 0xffff) counts[slot].tf++;
+                break;
+            }
+            length++;
+        }
+    }
+
+    unsigned short capped = length > 0xffff ? 0xffff : (unsigned short)length;
+    for (int i = 0; i < DOC_TERMS; i++) {
+        if (!counts[i].tf) continue;
+        IndexEntry entry = { counts[i].term, doc, counts[i].tf, capped };
+        if (add_entry(list, entry) != 0) return -1;
+    }
+    return length;
+}
+
+static void append_postings(EntryList *list) {
+    qsort(list->entries, list->count, sizeof(IndexEntry), by_bucket);
+    for (size_t i = 0; i < list->count;) {
+        int bucket = (int)(list->entries[i].term % ARCHIVE_BUCKETS);
+        size_t end = i;
+        while (end < list->count && (int)(list->entries[end].term % ARCHIVE_BUCKETS) == bucket) end++;
+
+        char name[16], path[MAX_SKILL_PATH];
+        snprintf(name, sizeof(name), "index/%02x", bucket);
+        archive_path(name, path, sizeof(path));
+        FILE *f = fopen(path, "ab");
+        if (f) {
+            fwrite(list->entries + i, sizeof(IndexEntry), end - i, f);
+            fclose(f);
+        }
+        i = end;
+    }
+}
+
+// Indexes a finished journal and replaces it with a gzipped copy.
+static void finalize(const char *session) {
+    char journal_path[MAX_SKILL_PATH], packed_path[MAX_SKILL_PATH], docs_path[MAX_SKILL_PATH];
+    snprintf(journal_path, sizeof(journal_path), "%s/sessions/%s.log", archive_dir, session);
+    snprintf(packed_path, sizeof(packed_path), "%s/sessions/%s.log.gz", archive_dir, session);
+    archive_path("docs", docs_path, sizeof(docs_path));
+
+    int lock = lock_archive();
+    if (lock == -1) return;
+
+    FILE *in = fopen(journal_path, "r");
+    FILE *docs = fopen(docs_path, "ab");
+    char cmd[MAX_SKILL_PATH * 2];
+    snprintf(cmd, sizeof(cmd), "gzip -q -c > '%s'", packed_path);
+    FILE *gz = in && docs ? popen(cmd, "w") : NULL;
+    if (!gz) {
+        if (in) fclose(in);
+        if (docs) fclose(docs);
+        close(lock);
+        return;
+    }
+
+    long doc_count;
+    long long total_length;
+    read_meta(&doc_count, &total_length);
+    fseek(docs, 0, SEEK_END);
+
+    static char line[MAX_JOURNAL_LINE];
+    EntryList postings = {0};
+    while (fgets(line, sizeof(line), in)) {
+        fputs(line, gz);
+        size_t len = strlen(line);
+        if (len == sizeof(line) - 1 && line[len - 1] != '\n') {
+            // Overlong entry: archive it, index only what fit.
+            int c;
+            while ((c = fgetc(in)) != EOF && c != '\n') fputc(c, gz);
+            fputc('\n', gz);
+        }
+        line[strcspn(line, "\n")] = '\0';
+
+        char *fields[5] = { line };
+        int n = 1;
+        for (char *p = line; n < 5 && (p = strchr(p, '\t')); n++) {
+            *p++ = '\0';
+            fields[n] = p;
+        }
+        if (n < 4) continue;
+        if (n == 4) fields[4] = "";
+        unescape(fields[3]);
+        unescape(fields[4]);
+
+        long offset = ftell(docs);
+        if (offset < 0 || offset > 0xffffffffL) break;
+
+        int length = index_entry(&postings, (unsigned int)offset, fields[3], fields[4]);
+        if (length <= 0) continue;
+
+        char snippet[SNIPPET_BYTES];
+        int size = snprintf(snippet, sizeof(snippet), "%s%s%s", fields[3], *fields[4] ? "\n" : "", fields[4]);
+        if (size >= (int)sizeof(snippet)) size = sizeof(snippet) - 1;
+
+        DocHeader header = { .time = atoll(fields[2]), .size = (unsigned int)size, .status = (short)atoi(fields[1]) };
+        snprintf(header.kind, sizeof(header.kind), "%s", fields[0]);
+        snprintf(header.session, sizeof(header.session), "%s", session);
+        fwrite(&header, sizeof(header), 1, docs);
+        fwrite(snippet, 1, size, docs);
+
+        doc_count++;
+        total_length += length;
+    }
+    fclose(in);
+    fclose(docs);
+
+    append_postings(&postings);
+    free(postings.entries);
+    write_meta(doc_count, total_length);
+
+    if (pclose(gz) == 0) unlink(journal_path);
+    else unlink(packed_path);
+    close(lock);
+}
+
+static int make_dir(const char *path) {
+    return mkdir(path, 0700) == 0 || errno == EEXIST ? 0 : -1;
+}
+
+// Sets up the archive and finishes journals left behind by sessions that
+// died without closing them.
+void archive_open(void) {
+    if (!config.archive || !getenv("HOME")) return;
+
+    char path[MAX_SKILL_PATH];
+    snprintf(path, sizeof(path), "%s/.agent-c", getenv("HOME"));
+    make_dir(path);
+    snprintf(archive_dir, sizeof(archive_dir), "%s/archive", path);
+    archive_path("sessions", path, sizeof(path));
+    if (make_dir(archive_dir) != 0 || make_dir(path) != 0) {
+        archive_dir[0] = '\0';
+        return;
+    }
+    archive_path("index", path, sizeof(path));
+    make_dir(path);
+
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    size_t len = strftime(session_name, sizeof(session_name), "%Y%m%d-%H%M%S", &tm);
+    snprintf(session_name + len, sizeof(session_name) - len, "-%d", (int)getpid());
+
+    archive_path("sessions", path, sizeof(path));
+    DIR *dir = opendir(path);
+    if (!dir) return;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char session[sizeof(session_name)];
+        size_t name_len = strlen(entry->d_name);
+        if (name_len < 5 || name_len - 4 >= sizeof(session) || strcmp(entry->d_name + name_len - 4, ".log") != 0) continue;
+        snprintf(session, sizeof(session), "%.*s", (int)(name_len - 4), entry->d_name);
+
+        const char *dash = strrchr(session, '-');
+        pid_t pid = dash ? (pid_t)atoi(dash + 1) : 0;
+        if (pid > 0 && kill(pid, 0) == -1 && errno == ESRCH) finalize(session);
+    }
+    closedir(dir);
+}
+
+// Appends one entry to the session journal, opening it on first use.
+void archive_record(const char *kind, const char *head, const char *body, int status) {
+    if (!config.archive || !archive_dir[0] || !*head) return;
+
+    if (!journal) {
+        char path[MAX_SKILL_PATH];
+        snprintf(path, sizeof(path), "%s/sessions/%s.log", archive_dir, session_name);
+        journal = fopen(path, "a");
+        if (!journal) return;
+        fcntl(fileno(journal), F_SETFD, FD_CLOEXEC);
+    }
+
+    fprintf(journal, "%s\t%d\t%lld\t", kind, status, (long long)time(NULL));
+    write_field(journal, head);
+    fputc('\t', journal);
+    write_field(journal, body ? body : "");
+    fputc('\n', journal);
+    fflush(journal);
+}
+
+void archive_close(void) {
+    if (!journal) return;
+    fclose(journal);
+    journal = NULL;
+    finalize(session_name);
+}
+
+// Open-addressed by doc id. A lookup gives up after MAX_PROBES slots, so a
+// crowded table costs a few dropped candidates rather than a full scan.
+static Hit *find_hit(Hit *hits, unsigned mask, unsigned int doc, int insert) {
+    unsigned slot = (doc * 2654435761u) & mask;
+    for (int i = 0; i < MAX_PROBES; i++, slot = (slot + 1) & mask) {
+        Hit *h = &hits[slot];
+        if (h->used && h->doc == doc) return h;
+        if (!h->used) {
+            if (!insert) return NULL;
+            h->used = 1;
+            h->doc = doc;
+            return h;
+        }
+    }
+    return NULL;
+}
+
+typedef struct {
+    unsigned long long term;
+    const IndexEntry *entries;
+    size_t count;
+    long df;
+} QueryTerm;
+
+static int by_df(const void *a, const void *b) {
+    long x = ((const QueryTerm *)a)->df, y = ((const QueryTerm *)b)->df;
+    return (x > y) - (x < y);
+}
+
+// The lowest tf at which no more than room of term's postings are kept.
+static int tf_cutoff(const QueryTerm *q, long room) {
+    long with_tf[TF_LEVELS + 1] = {0};
+    for (size_t i = 0; i < q->count; i++) {
+        const IndexEntry *e = &q->entries[i];
+        if (e->term == q->term) with_tf[e->tf < TF_LEVELS ? e->tf : TF_LEVELS]++;
+    }
+    long kept = 0;
+    for (int tf = TF_LEVELS; tf > 0; tf--) {
+        if (kept + with_tf[tf] > room) return tf + 1;
+        kept += with_tf[tf];
+    }
+    return 1;
+}
+
+// Ranks archived entries against query with BM25; fills top with up to k
+// hits, best first, and returns how many. Terms are scored rarest first and
+// the candidate table is sized from their summed document frequency. Once
+// it would pass MAX_CANDIDATES, a common term only adds its highest-tf
+// postings as new candidates and otherwise just scores the ones already in.
+static int search(const char *query, Hit *top, int k) {
+    if (!archive_dir[0]) return 0;
+
+    long doc_count;
+    long long total_length;
+    read_meta(&doc_count, &total_length);
+    if (!doc_count) return 0;
+    double avg_length = (double)total_length / doc_count;
+
+    QueryTerm terms[MAX_QUERY_TERMS];
+    int term_count = 0;
+    long total_df = 0;
+    char term[MAX_TERM];
+    for (const char *p = query; term_count < MAX_QUERY_TERMS && next_term(&p, term, sizeof(term));) {
+        unsigned long long h = term_hash(term);
+        int dup = 0;
+        for (int i = 0; i < term_count; i++) dup |= terms[i].term == h;
+        if (dup) continue;
+
+        char name[16], path[MAX_SKILL_PATH];
+        snprintf(name, sizeof(name), "index/%02x", (int)(h % ARCHIVE_BUCKETS));
+        archive_path(name, path, sizeof(path));
+
+        int fd = open(path, O_RDONLY);
+        if (fd == -1) continue;
+        struct stat st;
+        size_t count = fstat(fd, &st) == 0 ? (size_t)st.st_size / sizeof(IndexEntry) : 0;
+        const IndexEntry *entries = count ? mmap(NULL, count * sizeof(IndexEntry), PROT_READ, MAP_SHARED, fd, 0) : NULL;
+        close(fd);
+        if (!entries || entries == MAP_FAILED) continue;
+
+        QueryTerm *q = &terms[term_count++];
+        *q = (QueryTerm){h, entries, count, 0};
+        for (size_t i = 0; i < count; i++) q->df += entries[i].term == h;
+        total_df += q->df;
+    }
+    qsort(terms, term_count, sizeof(QueryTerm), by_df);
+
+    // Kept at most half full so probe runs stay short.
+    static Hit hits[MAX_CANDIDATES * 2];
+    unsigned size = 64;
+    while (size < MAX_CANDIDATES * 2 && (long)size < total_df * 2) size *= 2;
+    memset(hits, 0, size * sizeof(Hit));
+
+    long candidates = 0;
+    for (int t = 0; t < term_count; t++) {
+        QueryTerm *q = &terms[t];
+        double idf = log(1.0 + (doc_count - q->df + 0.5) / (q->df + 0.5));
+        long room = MAX_CANDIDATES - candidates;
+        int cutoff = q->df <= room ? 1 : tf_cutoff(q, room);
+
+        for (size_t i = 0; q->df && i < q->count; i++) {
+            const IndexEntry *e = &q->entries[i];
+            if (e->term != q->term) continue;
+            int insert = e->tf >= cutoff && candidates < MAX_CANDIDATES;
+            Hit *hit = find_hit(hits, size - 1, e->doc, insert);
+            if (!hit) continue;
+            if (hit->score == 0) candidates++;
+            double norm = 1.0 - BM25_B + BM25_B * e->length / avg_length;
+            hit->score += idf * e->tf * (BM25_K1 + 1.0) / (e->tf + BM25_K1 * norm);
+        }
+        munmap((void *)q->entries, q->count * sizeof(IndexEntry));
+    }
+
+    // Equal scores go to the newer entry.
+    int found = 0;
+    while (found < k) {
+        Hit *best = NULL;
+        for (unsigned i = 0; i < size; i++) {
+            Hit *h = &hits[i];
+            if (h->score > 0 && (!best || h->score > best->score || (h->score == best->score && h->doc > best->doc))) best = h;
+        }
+        if (!best) break;
+        top[found++] = *best;
+        best->score = -1;
+    }
+    return found;
+}
+
+static int read_doc(int fd, unsigned int doc, DocHeader *header, char *text, size_t size) {
+    if (pread(fd, header, sizeof(*header), doc) != (ssize_t)sizeof(*header)) return -1;
+    size_t len = header->size < size - 1 ? header->size : size - 1;
+    ssize_t n = pread(fd, text, len, (off_t)doc + sizeof(*header));
+    for (n = n > 0 ? n : 0; n && (text[n - 1] == '\n' || text[n - 1] == ' '); n--) {}
+    text[n] = '\0';
+    return 0;
+}
+
+static int open_docs(void) {
+    char path[MAX_SKILL_PATH];
+    archive_path("docs", path, sizeof(path));
+    return open(path, O_RDONLY);
+}
+
+// "2026-01-31 09:15 shell, exit 1"
+static void format_label(const DocHeader *header, char *out, size_t size) {
+    time_t t = (time_t)header->time;
+    struct tm tm;
+    localtime_r(&t, &tm);
+    size_t len = strftime(out, size, "%Y-%m-%d %H:%M ", &tm);
+    if (strcmp(header->kind, "shell") == 0 || strcmp(header->kind, "skill") == 0) {
+        snprintf(out + len, size - len, "%s, exit %d", header->kind, header->status);
+    } else {
+        snprintf(out + len, size - len, "%s", header->kind);
+    }
+}
+
+void archive_search(const char *query) {
+    if (!config.archive) {
+        printf("Session archive is disabled (AGENTC_ARCHIVE=0)\n");
+        return;
+    }
+    if (!*query) {
+        printf("Usage: /search <words from a prompt, command or output>\n");
+        return;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    Hit top[MAX_RESULTS];
+    int found = search(query, top, MAX_RESULTS);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+
+    printf("\033[36m🔎 %d match%s in %.1f ms\033[0m\n", found, found == 1 ? "" : "es", ms);
+    int fd = found ? open_docs() : -1;
+    for (int i = 0; fd != -1 && i < found; i++) {
+        DocHeader header;
+        char text[SNIPPET_BYTES], label[64];
+        if (read_doc(fd, top[i].doc, &header, text, sizeof(text)) != 0) continue;
+        format_label(&header, label, sizeof(label));
+
+        char *body = strchr(text, '\n');
+        if (body) *body++ = '\0';
+        printf("\033[33m[%s]\033[0m %s\n", label, text);
+
+        // A few lines of output are enough to recognise the entry.
+        for (int line = 0; body && *body && line < 3; line++) {
+            char *nl = strchr(body, '\n');
+            printf("    %.*s\n", nl ? (int)(nl - body) : (int)strlen(body), body);
+            body = nl ? nl + 1 : NULL;
+        }
+    }
+    if (fd != -1) close(fd);
+}
+
+// Formats the config.recall best snippets for task as context for a new
+// session. Returns how many were written.
+int archive_recall(const char *task, char *out, size_t size) {
+    if (!config.archive || config.recall <= 0) return 0;
+
+    Hit top[MAX_RESULTS];
+    int found = search(task, top, config.recall < MAX_RESULTS ? config.recall : MAX_RESULTS);
+    int fd = found ? open_docs() : -1;
+    if (fd == -1) return 0;
+
+    size_t used = snprintf(out, size, "Possibly relevant entries from earlier sessions (may be outdated):\n");
+    int written = 0;
+    for (int i = 0; i < found && used < size - 1; i++) {
+        DocHeader header;
+        char text[SNIPPET_BYTES], label[64];
+        if (read_doc(fd, top[i].doc, &header, text, sizeof(text)) != 0) continue;
+        format_label(&header, label, sizeof(label));
+
+        used += snprintf(out + used, size - used, "\n[%s]\n%s\n", label, text);
+        written++;
+    }
+    close(fd);
+    if (used >= size) out[size - 1] = '\0';
+    return written;
+}
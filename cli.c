@@ -7,14 +7,32 @@ void run_cli(void) {
         printf("\033[32m🤠Agent> \033[0m");
         fflush(stdout);
 
-        if (!fgets(input, sizeof(input), stdin)) break;
-
-        char *nl = strchr(input, '\n');
-        if (nl) *nl = '\0';
+        // Ctrl-C at an idle prompt ends the session.
+        int rc = loop_readline(input, sizeof(input));
+        if (rc != 1) {
+            if (rc == LOOP_CANCELLED) printf("\n");
+            break;
+        }
 
         char *cmd = trim(input);
         if (!*cmd) continue;
 
-        if (process_agent(cmd)) printf("Failed\n");
+        if (strcmp(cmd, "/usage") == 0) {
+            usage_summary();
+            route_summary();
+            continue;
+        }
+
+        if (strncmp(cmd, "/search", 7) == 0 && (!cmd[7] || cmd[7] == ' ')) {
+            archive_search(trim(cmd + 7));
+            continue;
+        }
+
+        int status = process_agent(cmd);
+        if (status == LOOP_CANCELLED) {
+            printf("\033[33m⛔ Cancelled\033[0m\n");
+        } else if (status) {
+            printf("Failed\n");
+        }
     }
 }
@@ -0,0 +1,170 @@
+#include "agent-c.h"
+
+extern Config config;
+
+// History deduplication at serialization time. The model often re-runs the
+// same cat, git diff or skill script; rather than resending the full output,
+// a tool result that repeats an earlier one still in the window goes out as a
+// reference to that tool call, and one that differs in a few lines goes out
+// as a line diff against it. History itself keeps the full text, so nothing
+// is lost locally. Only results that went out in full in the same request
+// are used as a base, so the model never has to chain references or diffs.
+
+#define DEDUP_MIN_BYTES 256
+#define MAX_DIFF_LINES 256
+#define MIN_SHARED_LINES 0.5
+#define MAX_DELTA_RATIO 0.6
+
+typedef struct {
+    const char *start;
+    int len;
+    unsigned long long hash;
+} Line;
+
+static unsigned short lcs[MAX_DIFF_LINES + 1][MAX_DIFF_LINES + 1];
+
+static unsigned long long fnv1a(const char *s, size_t len) {
+    unsigned long long h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Splits text into lines (newline included); -1 if there are too many.
+static int split_lines(const char *text, Line *lines) {
+    int n = 0;
+    for (const char *p = text; *p; n++) {
+        if (n == MAX_DIFF_LINES) return -1;
+        const char *nl = strchr(p, '\n');
+        int len = nl ? (int)(nl - p) + 1 : (int)strlen(p);
+        lines[n] = (Line){ p, len, fnv1a(p, len) };
+        p += len;
+    }
+    return n;
+}
+
+static int same_line(const Line *a, const Line *b) {
+    return a->hash == b->hash && a->len == b->len && memcmp(a->start, b->start, a->len) == 0;
+}
+
+// Fraction of b's lines that also occur somewhere in a.
+static double shared_lines(const Line *a, int n, const Line *b, int m) {
+    if (!m) return 0;
+    int shared = 0;
+    for (int j = 0; j < m; j++) {
+        for (int i = 0; i < n; i++) {
+            if (same_line(&a[i], &b[j])) { shared++; break; }
+        }
+    }
+    return (double)shared / m;
+}
+
+static void emit(char *out, size_t size, size_t *used, const char *fmt_prefix, const Line *line) {
+    if (*used >= size - 1) return;
+    int room = (int)(size - *used);
+    int wrote = snprintf(out + *used, room, "%s%.*s%s", fmt_prefix, line->len, line->start,
+                         line->len && line->start[line->len - 1] == '\n' ? "" : "\n");
+    *used += wrote < room ? (size_t)wrote : (size_t)room - 1;
+}
+
+static void flush_hunk(char *out, size_t size, size_t *used, const Line *a, int del_from, int del_to,
+                       const Line *b, int add_from, int add_to) {
+    if (del_from == del_to && add_from == add_to) return;
+    if (*used < size - 1) {
+        // As in unified diffs, an empty range names the line before it.
+        int dels = del_to - del_from, adds = add_to - add_from;
+        *used += snprintf(out + *used, size - *used, "@@ -%d,%d +%d,%d @@\n",
+                          del_from + (dels > 0), dels, add_from + (adds > 0), adds);
+        if (*used > size - 1) *used = size - 1;
+    }
+    for (int i = del_from; i < del_to; i++) emit(out, size, used, "-", &a[i]);
+    for (int j = add_from; j < add_to; j++) emit(out, size, used, "+", &b[j]);
+}
+
+// Writes a zero-context unified diff turning a into b; returns its length.
+static size_t line_diff(const Line *a, int n, const Line *b, int m, char *out, size_t size) {
+    for (int i = n; i >= 0; i--) {
+        for (int j = m; j >= 0; j--) {
+            if (i == n || j == m) lcs[i][j] = 0;
+            else if (same_line(&a[i], &b[j])) lcs[i][j] = lcs[i + 1][j + 1] + 1;
+            else lcs[i][j] = lcs[i + 1][j] > lcs[i][j + 1] ? lcs[i + 1][j] : lcs[i][j + 1];
+        }
+    }
+
+    size_t used = 0;
+    out[0] = '\0';
+    int i = 0, j = 0, del_from = 0, add_from = 0;
+    while (i < n || j < m) {
+        if (i < n && j < m && same_line(&a[i], &b[j])) {
+            flush_hunk(out, size, &used, a, del_from, i, b, add_from, j);
+            del_from = ++i;
+            add_from = ++j;
+        } else if (j == m || (i < n && lcs[i + 1][j] >= lcs[i][j + 1])) {
+            i++;
+        } else {
+            j++;
+        }
+    }
+    flush_hunk(out, size, &used, a, del_from, i, b, add_from, j);
+    return used;
+}
+
+static int is_tool(const Message *m) {
+    return strcmp(m->role, "tool") == 0;
+}
+
+// Returns the text to send for message `index`: its own content, or a
+// reference / delta written to out when an earlier tool result in the
+// window makes that cheaper. sent_full flags the earlier messages that were
+// sent as their own content.
+const char *dedup_content(const Agent *agent, int index, const int *sent_full, char *out, size_t size) {
+    const Message *m = &agent->messages[index];
+    size_t len = strlen(m->content);
+    if (!config.dedup || !is_tool(m) || len < DEDUP_MIN_BYTES) return m->content;
+
+    unsigned long long hash = fnv1a(m->content, len);
+    for (int i = 1; i < index; i++) {
+        const Message *prev = &agent->messages[i];
+        if (!is_tool(prev) || !sent_full[i] || fnv1a(prev->content, strlen(prev->content)) != hash ||
+            strcmp(prev->content, m->content) != 0) continue;
+
+        char id[64];
+        json_tool_call_id(prev->tool_calls, id, sizeof(id));
+        snprintf(out, size, "[Output identical to the result of tool call %s above]", id);
+        return out;
+    }
+
+    // Near-identical: diff against the earlier result sharing the most lines.
+    static Line cur[MAX_DIFF_LINES], best_lines[MAX_DIFF_LINES], cand[MAX_DIFF_LINES];
+    int m_lines = split_lines(m->content, cur);
+    if (m_lines <= 0) return m->content;
+
+    int best = -1, best_n = 0;
+    double best_share = MIN_SHARED_LINES;
+    for (int i = 1; i < index; i++) {
+        const Message *prev = &agent->messages[i];
+        if (!is_tool(prev) || !sent_full[i]) continue;
+        int n = split_lines(prev->content, cand);
+        if (n <= 0) continue;
+
+        double share = shared_lines(cand, n, cur, m_lines);
+        if (share > best_share) {
+            best = i;
+            best_n = n;
+            best_share = share;
+            memcpy(best_lines, cand, sizeof(Line) * n);
+        }
+    }
+    if (best == -1) return m->content;
+
+    char id[64];
+    json_tool_call_id(agent->messages[best].tool_calls, id, sizeof(id));
+    size_t used = snprintf(out, size, "[Output of tool call %s above with these line changes:]\n", id);
+    if (used >= size) return m->content;
+
+    size_t delta = line_diff(best_lines, best_n, cur, m_lines, out + used, size - used);
+    if (used + delta >= size - 1 || used + delta > len * MAX_DELTA_RATIO) return m->content;
+    return out;
+}
@@ -0,0 +1,595 @@
+#include "agent-c.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <regex.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Native file tools: read_file, list_dir and grep run in-process instead of
+// through the shell. Every result fits the buffer it is given and ends with a
+// note telling the model how to fetch the next page, so it receives exactly
+// the slice it asked for rather than a truncated cat or ls.
+
+#define FOOTER_ROOM 192
+#define DEFAULT_ENTRIES 100
+#define DEFAULT_MATCHES 50
+#define GREP_THREADS 8
+#define GREP_MAX_MATCHES 2000
+#define GREP_MAX_FILE (16L * 1024 * 1024)
+#define GREP_TEXT 160
+
+typedef struct {
+    const char *data;
+    size_t size;
+} Mapped;
+
+static int arg_int(const char *arguments, const char *key, int fallback) {
+    char value[32];
+    return json_arg(arguments, key, value, sizeof(value)) ? atoi(value) : fallback;
+}
+
+static int fail(char *result, size_t size, const char *what, const char *path) {
+    snprintf(result, size, "Error: cannot %s '%s': %s", what, path, strerror(errno));
+    return -1;
+}
+
+static int map_file(const char *path, Mapped *m) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        close(fd);
+        errno = S_ISDIR(st.st_mode) ? EISDIR : EINVAL;
+        return -1;
+    }
+
+    m->size = (size_t)st.st_size;
+    m->data = m->size ? mmap(NULL, m->size, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+    close(fd);
+    if (m->data == MAP_FAILED) return -1;
+    return 0;
+}
+
+static void unmap_file(Mapped *m) {
+    if (m->size) munmap((void *)m->data, m->size);
+}
+
+static int is_binary(const char *data, size_t size) {
+    return memchr(data, '\0', size < 1024 ? size : 1024) != NULL;
+}
+
+// Lines are 1-based; max_lines of 0 means as many as fit.
+static int read_lines(const char *path, const Mapped *m, int start, int max_lines, char *result, size_t size) {
+    const char *p = m->data, *end = m->data + m->size;
+    int line = 1;
+    while (line < start && p < end) {
+        const char *nl = memchr(p, '\n', end - p);
+        p = nl ? nl + 1 : end;
+        line++;
+    }
+
+    int total = line - 1;
+    for (const char *q = p; q < end; total++) {
+        const char *nl = memchr(q, '\n', end - q);
+        q = nl ? nl + 1 : end;
+    }
+    if (p >= end) {
+        snprintf(result, size, "[%s has %d lines]", path, total);
+        return 0;
+    }
+
+    size_t room = size - FOOTER_ROOM, used = 0;
+    int shown = 0;
+    while (p < end && (!max_lines || shown < max_lines)) {
+        const char *nl = memchr(p, '\n', end - p);
+        size_t len = nl ? (size_t)(nl - p) + 1 : (size_t)(end - p);
+        if (used + len > room) {
+            if (shown) break;
+            // A single line longer than the buffer: show its start and
+            // point at the byte range for the rest.
+            memcpy(result, p, room);
+            snprintf(result + room, size - room, "\n[line %d of %s truncated; read the rest with offset=%ld]",
+                     start, path, (long)(p - m->data) + (long)room);
+            return 0;
+        }
+        memcpy(result + used, p, len);
+        used += len;
+        p += len;
+        shown++;
+    }
+
+    const char *sep = used && result[used - 1] != '\n' ? "\n" : "";
+    if (p < end) {
+        snprintf(result + used, size - used, "%s[lines %d-%d of %d in %s; continue with start_line=%d]",
+                 sep, start, start + shown - 1, total, path, start + shown);
+    } else {
+        snprintf(result + used, size - used, "%s[lines %d-%d of %d in %s]", sep, start, start + shown - 1, total, path);
+    }
+    return 0;
+}
+
+static int read_bytes(const char *path, const Mapped *m, long offset, long length, char *result, size_t size) {
+    if (offset < 0 || (size_t)offset > m->size) offset = (long)m->size;
+    size_t room = size - FOOTER_ROOM, len = m->size - (size_t)offset;
+    if (length > 0 && (size_t)length < len) len = (size_t)length;
+    if (len > room) len = room;
+
+    memcpy(result, m->data + offset, len);
+    size_t next = (size_t)offset + len;
+    const char *sep = len && result[len - 1] != '\n' ? "\n" : "";
+    if (next < m->size) {
+        snprintf(result + len, size - len, "%s[bytes %ld-%zu of %zu in %s; continue with offset=%zu]",
+                 sep, offset, next, m->size, path, next);
+    } else {
+        snprintf(result + len, size - len, "%s[bytes %ld-%zu of %zu in %s]", sep, offset, next, m->size, path);
+    }
+    return 0;
+}
+
+static int read_file(const char *arguments, char *result, size_t size) {
+    char path[MAX_SKILL_PATH];
+    if (!json_arg(arguments, "path", path, sizeof(path))) {
+        snprintf(result, size, "Error: read_file needs a path");
+        return -1;
+    }
+
+    Mapped m;
+    if (map_file(path, &m) != 0) return fail(result, size, "read", path);
+
+    int rc = 0;
+    char value[32];
+    if (is_binary(m.data, m.size)) {
+        snprintf(result, size, "[%s is a binary file of %zu bytes]", path, m.size);
+    } else if (json_arg(arguments, "offset", value, sizeof(value)) || json_arg(arguments, "length", value, sizeof(value))) {
+        rc = read_bytes(path, &m, arg_int(arguments, "offset", 0), arg_int(arguments, "length", 0), result, size);
+    } else {
+        int start = arg_int(arguments, "start_line", 1);
+        rc = read_lines(path, &m, start < 1 ? 1 : start, arg_int(arguments, "max_lines", 0), result, size);
+    }
+
+    unmap_file(&m);
+    return rc;
+}
+
+static int by_name(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void format_mode(mode_t mode, char *out) {
+    out[0] = S_ISDIR(mode) ? 'd' : S_ISLNK(mode) ? 'l' : S_ISREG(mode) ? '-' : '?';
+    const char *bits = "rwxrwxrwx";
+    for (int i = 0; i < 9; i++) out[i + 1] = mode & (0400 >> i) ? bits[i] : '-';
+    out[10] = '\0';
+}
+
+static int list_dir(const char *arguments, char *result, size_t size) {
+    char path[MAX_SKILL_PATH];
+    if (!json_arg(arguments, "path", path, sizeof(path))) snprintf(path, sizeof(path), ".");
+
+    DIR *dir = opendir(path);
+    if (!dir) return fail(result, size, "list", path);
+
+    char **names = NULL;
+    size_t count = 0, capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            char **grown = realloc(names, capacity * sizeof(char *));
+            if (!grown) break;
+            names = grown;
+        }
+        if (!(names[count] = strdup(entry->d_name))) break;
+        count++;
+    }
+    closedir(dir);
+    if (count) qsort(names, count, sizeof(char *), by_name);
+
+    int offset = arg_int(arguments, "offset", 0), limit = arg_int(arguments, "limit", DEFAULT_ENTRIES);
+    if (offset < 0) offset = 0;
+    if (limit < 1) limit = DEFAULT_ENTRIES;
+
+    size_t used = 0, room = size - FOOTER_ROOM;
+    int i = offset;
+    for (; i < (int)count && i < offset + limit; i++) {
+        char full[MAX_SKILL_PATH * 2], mode[11], when[20], line[MAX_SKILL_PATH * 2];
+        snprintf(full, sizeof(full), "%s/%s", path, names[i]);
+
+        struct stat st;
+        if (lstat(full, &st) == -1) memset(&st, 0, sizeof(st));
+        format_mode(st.st_mode, mode);
+        struct tm tm;
+        localtime_r(&st.st_mtime, &tm);
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M", &tm);
+
+        char target[MAX_SKILL_PATH] = "";
+        if (S_ISLNK(st.st_mode)) {
+            ssize_t n = readlink(full, target, sizeof(target) - 1);
+            target[n > 0 ? n : 0] = '\0';
+        }
+
+        int len = snprintf(line, sizeof(line), "%s %10lld %s %s%s%s%s\n", mode, (long long)st.st_size, when,
+                           names[i], S_ISDIR(st.st_mode) ? "/" : "", *target ? " -> " : "", target);
+        if (used + len > room) break;
+        memcpy(result + used, line, len);
+        used += len;
+    }
+    result[used] = '\0';
+
+    if (i < (int)count) {
+        snprintf(result + used, size - used, "[entries %d-%d of %zu in %s; continue with offset=%d]",
+                 offset + 1, i, count, path, i);
+    } else {
+        snprintf(result + used, size - used, "[%zu entries in %s]", count, path);
+    }
+
+    for (size_t j = 0; j < count; j++) free(names[j]);
+    free(names);
+    return 0;
+}
+
+typedef struct {
+    char *path;
+    int line;
+    char text[GREP_TEXT];
+} Match;
+
+// Directories waiting to be scanned are shared by the walker threads; the
+// walk ends when the queue is empty and no thread is still reading one.
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t more;
+    char **dirs;
+    size_t dir_count, dir_capacity;
+    int active;
+    regex_t re;
+    char include[MAX_SKILL_NAME];
+    Match *matches;
+    size_t match_count, match_capacity;
+    int truncated;
+    long files;
+} GrepJob;
+
+static void push_dir(GrepJob *job, char *dir) {
+    if (job->dir_count == job->dir_capacity) {
+        size_t capacity = job->dir_capacity ? job->dir_capacity * 2 : 64;
+        char **grown = realloc(job->dirs, capacity * sizeof(char *));
+        if (!grown) {
+            free(dir);
+            return;
+        }
+        job->dirs = grown;
+        job->dir_capacity = capacity;
+    }
+    job->dirs[job->dir_count++] = dir;
+    pthread_cond_signal(&job->more);
+}
+
+static int by_location(const void *a, const void *b) {
+    const Match *x = a, *y = b;
+    int c = strcmp(x->path, y->path);
+    return c ? c : x->line - y->line;
+}
+
+static void swap_matches(Match *a, Match *b) {
+    Match t = *a;
+    *a = *b;
+    *b = t;
+}
+
+// Matches are kept as a max-heap by location, so once GREP_MAX_MATCHES are
+// held the last one is at the top and is what a new, earlier match evicts.
+// The kept set is then always the first matches in path order, however the
+// threads happen to be scheduled.
+static void heap_push(Match *heap, size_t count) {
+    for (size_t i = count - 1; i && by_location(&heap[i], &heap[(i - 1) / 2]) > 0; i = (i - 1) / 2) {
+        swap_matches(&heap[i], &heap[(i - 1) / 2]);
+    }
+}
+
+static void heap_sift_down(Match *heap, size_t count) {
+    for (size_t i = 0;;) {
+        size_t largest = i, left = 2 * i + 1, right = left + 1;
+        if (left < count && by_location(&heap[left], &heap[largest]) > 0) largest = left;
+        if (right < count && by_location(&heap[right], &heap[largest]) > 0) largest = right;
+        if (largest == i) return;
+        swap_matches(&heap[i], &heap[largest]);
+        i = largest;
+    }
+}
+
+// Returns 0 when the match falls after everything kept, so the rest of the
+// file can be skipped.
+static int add_match(GrepJob *job, const char *path, int line, const char *text) {
+    Match m = { .line = line };
+    snprintf(m.text, sizeof(m.text), "%s", text);
+
+    pthread_mutex_lock(&job->lock);
+    int kept = 1;
+    if (job->match_count == GREP_MAX_MATCHES) {
+        job->truncated = 1;
+        m.path = (char *)path;
+        kept = by_location(&m, &job->matches[0]) < 0;
+        if (kept && (m.path = strdup(path))) {
+            free(job->matches[0].path);
+            job->matches[0] = m;
+            heap_sift_down(job->matches, job->match_count);
+        }
+    } else {
+        if (job->match_count == job->match_capacity) {
+            size_t capacity = job->match_capacity ? job->match_capacity * 2 : 64;
+            Match *grown = realloc(job->matches, capacity * sizeof(Match));
+            if (grown) {
+                job->matches = grown;
+                job->match_capacity = capacity;
+            }
+        }
+        if (job->match_count < job->match_capacity && (m.path = strdup(path))) {
+            job->matches[job->match_count++] = m;
+            heap_push(job->matches, job->match_count);
+        }
+    }
+    pthread_mutex_unlock(&job->lock);
+    return kept;
+}
+
+// True once the cap is reached and every path starting with prefix sorts
+// after the last match kept; such files and directories are not read.
+static int past_cap(GrepJob *job, const char *prefix) {
+    pthread_mutex_lock(&job->lock);
+    int past = job->match_count == GREP_MAX_MATCHES && strcmp(prefix, job->matches[0].path) > 0;
+    if (past) job->truncated = 1;
+    pthread_mutex_unlock(&job->lock);
+    return past;
+}
+
+// Each walker thread reads files into its own buffer.
+typedef struct {
+    char *data;
+    size_t capacity;
+} FileBuffer;
+
+static int load_file(const char *path, FileBuffer *buf, size_t *size) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !st.st_size || st.st_size > GREP_MAX_FILE) {
+        close(fd);
+        return -1;
+    }
+    if ((size_t)st.st_size + 1 > buf->capacity) {
+        char *grown = realloc(buf->data, (size_t)st.st_size + 1);
+        if (!grown) {
+            close(fd);
+            return -1;
+        }
+        buf->data = grown;
+        buf->capacity = (size_t)st.st_size + 1;
+    }
+
+    size_t got = 0;
+    for (ssize_t n; got < (size_t)st.st_size && (n = read(fd, buf->data + got, st.st_size - got)) != 0;) {
+        if (n > 0) got += n;
+        else if (errno != EINTR) break;
+    }
+    close(fd);
+    buf->data[got] = '\0';
+    *size = got;
+    return 0;
+}
+
+// The whole file goes to regexec() at once; with REG_NEWLINE a match never
+// spans lines, so the scan resumes at the line after each match.
+static void grep_file(GrepJob *job, const char *path, FileBuffer *buf) {
+    size_t size;
+    if (past_cap(job, path) || load_file(path, buf, &size) != 0 || is_binary(buf->data, size)) return;
+
+    const char *p = buf->data, *end = buf->data + size;
+    int line = 1;
+    regmatch_t match;
+    while (p < end && !loop_cancelled() && regexec(&job->re, p, 1, &match, 0) == 0) {
+        const char *at = p + match.rm_so;
+        for (const char *nl; (nl = memchr(p, '\n', at - p)); p = nl + 1) line++;
+
+        const char *nl = memchr(at, '\n', end - at);
+        char text[GREP_TEXT];
+        size_t len = nl ? (size_t)(nl - p) : (size_t)(end - p);
+        snprintf(text, sizeof(text), "%.*s", (int)(len < sizeof(text) ? len : sizeof(text) - 1), p);
+        if (!add_match(job, path, line, trim(text)) || !nl) break;
+        p = nl + 1;
+        line++;
+    }
+
+    pthread_mutex_lock(&job->lock);
+    job->files++;
+    pthread_mutex_unlock(&job->lock);
+}
+
+// "." is left out of the paths shown to the model.
+static void join_path(const char *dir, const char *name, char *out, size_t size) {
+    if (strcmp(dir, ".") == 0) snprintf(out, size, "%s", name);
+    else snprintf(out, size, "%s%s%s", dir, dir[strlen(dir) - 1] == '/' ? "" : "/", name);
+}
+
+// Symlinks are not followed and dot-directories such as .git are skipped.
+// Ctrl-C stops the walk; directories still queued are then dropped unread.
+static void scan_dir(GrepJob *job, const char *dir_path, FileBuffer *buf) {
+    char prefix[MAX_SKILL_PATH * 2];
+    join_path(dir_path, "", prefix, sizeof(prefix));
+    if (loop_cancelled() || (*prefix && past_cap(job, prefix))) return;
+
+    DIR *dir = opendir(dir_path);
+    if (!dir) return;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL && !loop_cancelled()) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+
+        char full[MAX_SKILL_PATH * 2];
+        join_path(dir_path, entry->d_name, full, sizeof(full));
+        struct stat st;
+        if (lstat(full, &st) == -1) continue;
+
+        if (S_ISDIR(st.st_mode)) {
+            if (entry->d_name[0] == '.') continue;
+            char *copy = strdup(full);
+            if (!copy) continue;
+            pthread_mutex_lock(&job->lock);
+            push_dir(job, copy);
+            pthread_mutex_unlock(&job->lock);
+        } else if (S_ISREG(st.st_mode) && (!job->include[0] || fnmatch(job->include, entry->d_name, 0) == 0)) {
+            grep_file(job, full, buf);
+        }
+    }
+    closedir(dir);
+}
+
+static void *grep_worker(void *arg) {
+    GrepJob *job = arg;
+    FileBuffer buf = {0};
+    pthread_mutex_lock(&job->lock);
+    for (;;) {
+        while (!job->dir_count && job->active) pthread_cond_wait(&job->more, &job->lock);
+        if (!job->dir_count) break;
+
+        char *dir = job->dirs[--job->dir_count];
+        job->active++;
+        pthread_mutex_unlock(&job->lock);
+
+        scan_dir(job, dir, &buf);
+        free(dir);
+
+        pthread_mutex_lock(&job->lock);
+        job->active--;
+    }
+    pthread_cond_broadcast(&job->more);
+    pthread_mutex_unlock(&job->lock);
+    free(buf.data);
+    return NULL;
+}
+
+static int grep(const char *arguments, char *result, size_t size) {
+    char pattern[MAX_SKILL_PATH], path[MAX_SKILL_PATH], flag[8];
+    if (!json_arg(arguments, "pattern", pattern, sizeof(pattern))) {
+        snprintf(result, size, "Error: grep needs a pattern");
+        return -1;
+    }
+    if (!json_arg(arguments, "path", path, sizeof(path))) snprintf(path, sizeof(path), ".");
+    int icase = json_arg(arguments, "ignore_case", flag, sizeof(flag)) && strcmp(flag, "true") == 0;
+
+    static GrepJob job;
+    memset(&job, 0, sizeof(job));
+    json_arg(arguments, "include", job.include, sizeof(job.include));
+
+    int rc = regcomp(&job.re, pattern, REG_EXTENDED | REG_NEWLINE | (icase ? REG_ICASE : 0));
+    if (rc != 0) {
+        char why[128];
+        regerror(rc, &job.re, why, sizeof(why));
+        snprintf(result, size, "Error: invalid pattern '%s': %s", pattern, why);
+        return -1;
+    }
+
+    struct stat st;
+    if (stat(path, &st) == -1) {
+        regfree(&job.re);
+        return fail(result, size, "search", path);
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        pthread_mutex_init(&job.lock, NULL);
+        pthread_cond_init(&job.more, NULL);
+        push_dir(&job, strdup(path));
+
+        int threads = GREP_THREADS;
+#ifdef _SC_NPROCESSORS_ONLN
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (cpus > 0 && cpus < threads) threads = (int)cpus;
+#endif
+        pthread_t ids[GREP_THREADS];
+        int started = 0;
+        for (; started < threads; started++) {
+            if (pthread_create(&ids[started], NULL, grep_worker, &job) != 0) break;
+        }
+        if (!started) grep_worker(&job);
+        for (int i = 0; i < started; i++) pthread_join(ids[i], NULL);
+
+        pthread_cond_destroy(&job.more);
+        pthread_mutex_destroy(&job.lock);
+        free(job.dirs);
+    } else {
+        FileBuffer buf = {0};
+        pthread_mutex_init(&job.lock, NULL);
+        grep_file(&job, path, &buf);
+        pthread_mutex_destroy(&job.lock);
+        free(buf.data);
+    }
+    regfree(&job.re);
+
+    if (loop_cancelled()) {
+        for (size_t j = 0; j < job.match_count; j++) free(job.matches[j].path);
+        free(job.matches);
+        snprintf(result, size, "[grep cancelled by user]");
+        return LOOP_CANCELLED;
+    }
+
+    if (job.match_count) qsort(job.matches, job.match_count, sizeof(Match), by_location);
+
+    int offset = arg_int(arguments, "offset", 0), limit = arg_int(arguments, "limit", DEFAULT_MATCHES);
+    if (offset < 0) offset = 0;
+    if (limit < 1) limit = DEFAULT_MATCHES;
+
+    size_t used = 0, room = size - FOOTER_ROOM;
+    int i = offset;
+    for (; i < (int)job.match_count && i < offset + limit; i++) {
+        char line[MAX_SKILL_PATH + GREP_TEXT + 16];
+        const Match *m = &job.matches[i];
+        int len = snprintf(line, sizeof(line), "%s:%d: %s\n", m->path, m->line, m->text);
+        if (len >= (int)sizeof(line)) len = sizeof(line) - 1;
+        if (used + len > room) break;
+        memcpy(result + used, line, len);
+        used += len;
+    }
+    result[used] = '\0';
+
+    const char *more = job.truncated ? "+" : "";
+    if (i < (int)job.match_count) {
+        snprintf(result + used, size - used, "[matches %d-%d of %zu%s in %ld files; continue with offset=%d]",
+                 offset + 1, i, job.match_count, more, job.files, i);
+    } else {
+        snprintf(result + used, size - used, "[%zu%s matches in %ld files]", job.match_count, more, job.files);
+    }
+    if (job.truncated) {
+        size_t len = strlen(result);
+        snprintf(result + len, size - len, " [stopped at %d matches; narrow the pattern or path]", GREP_MAX_MATCHES);
+    }
+
+    for (size_t j = 0; j < job.match_count; j++) free(job.matches[j].path);
+    free(job.matches);
+    return 0;
+}
+
+int fs_is_tool(const char *name) {
+    return strcmp(name, "read_file") == 0 || strcmp(name, "list_dir") == 0 || strcmp(name, "grep") == 0;
+}
+
+// Runs one of the native tools; 0 on success, -1 with an error message in
+// result otherwise.
+int fs_tool(const char *name, const char *arguments, char *result, size_t size) {
+    result[0] = '\0';
+    if (strcmp(name, "read_file") == 0) return read_file(arguments, result, size);
+    if (strcmp(name, "list_dir") == 0) return list_dir(arguments, result, size);
+    if (strcmp(name, "grep") == 0) return grep(arguments, result, size);
+    snprintf(result, size, "Error: unknown tool '%s'", name);
+    return -1;
+}
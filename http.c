@@ -0,0 +1,419 @@
+#include "agent-c.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <time.h>
+#include <sys/wait.h>
+
+extern Config config;
+
+// Rolling latency histogram: power-of-two buckets starting at LAT_MIN_MS.
+// Every new sample decays the old counts so the quantiles follow the
+// endpoint's recent behaviour rather than the whole session.
+#define LAT_BUCKETS 16
+#define LAT_MIN_MS 16.0
+#define LAT_DECAY 0.9f
+#define LAT_MIN_SAMPLES 5
+
+#define BACKOFF_BASE_MS 500
+#define BACKOFF_CAP_MS 8000
+#define RETRY_AFTER_CAP_S 60
+
+#define COMPRESS_MIN_BYTES 1024
+
+typedef struct {
+    float counts[LAT_BUCKETS];
+    float total;
+    int samples;
+} LatencyHist;
+
+typedef enum { REQ_OK, REQ_RETRY, REQ_RATE_LIMITED, REQ_FATAL, REQ_CANCELLED } ReqClass;
+
+typedef struct {
+    int curl_rc;
+    int http_code;
+    double connect_s;
+    double first_byte_s;
+    int retry_after_s;
+    int cancelled;
+} Attempt;
+
+static LatencyHist connect_hist, first_byte_hist;
+
+static void hist_add(LatencyHist *h, double ms) {
+    int bucket = 0;
+    for (double edge = LAT_MIN_MS; ms > edge && bucket < LAT_BUCKETS - 1; edge *= 2) bucket++;
+
+    for (int i = 0; i < LAT_BUCKETS; i++) h->counts[i] *= LAT_DECAY;
+    h->counts[bucket] += 1;
+    h->total = h->total * LAT_DECAY + 1;
+    h->samples++;
+}
+
+static double hist_quantile_ms(const LatencyHist *h, double q) {
+    float want = h->total * q, seen = 0;
+    double edge = LAT_MIN_MS;
+    for (int i = 0; i < LAT_BUCKETS; i++, edge *= 2) {
+        seen += h->counts[i];
+        if (seen >= want) return edge;
+    }
+    return edge;
+}
+
+static int derive_timeout(const LatencyHist *h, int fallback, double factor, int lo, int hi) {
+    if (h->samples < LAT_MIN_SAMPLES) return fallback;
+    int t = (int)(hist_quantile_ms(h, 0.95) * factor / 1000.0 + 0.999);
+    return t < lo ? lo : t > hi ? hi : t;
+}
+
+static ReqClass classify(const Attempt *a) {
+    if (a->cancelled) return REQ_CANCELLED;
+    switch (a->curl_rc) {
+    case 0: break;
+    case 6: case 7: case 28: case 35: case 52: case 55: case 56: return REQ_RETRY;
+    default: return REQ_FATAL;
+    }
+
+    if (a->http_code >= 200 && a->http_code < 300) return REQ_OK;
+    if (a->http_code == 429) return REQ_RATE_LIMITED;
+    if (a->http_code == 408 || a->http_code == 500 || a->http_code == 502 ||
+        a->http_code == 503 || a->http_code == 504 || a->http_code == 529) return REQ_RETRY;
+    return REQ_FATAL;
+}
+
+static long backoff_ms(int attempt) {
+    long ceiling = BACKOFF_BASE_MS << attempt;
+    if (ceiling > BACKOFF_CAP_MS) ceiling = BACKOFF_CAP_MS;
+    return ceiling / 2 + rand() % (ceiling / 2 + 1);
+}
+
+static int make_temp(char *path, const char *prefix) {
+    snprintf(path, 64, "/tmp/%s_XXXXXX", prefix);
+    int fd = mkstemp(path);
+    if (fd == -1) return -1;
+    close(fd);
+    return 0;
+}
+
+static long long days_from_civil(int y, int m, int d) {
+    y -= m <= 2;
+    long long era = (y >= 0 ? y : y - 399) / 400;
+    long long yoe = y - era * 400;
+    long long doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+}
+
+// "Sun, 06 Nov 1994 08:49:37 GMT" as seconds since the epoch, or -1.
+static long long parse_http_date(const char *s) {
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    char mon[4];
+    int d, y, hh, mm, ss;
+    if (sscanf(s, " %*[^,], %d %3s %d %d:%d:%d", &d, mon, &y, &hh, &mm, &ss) != 6) return -1;
+    const char *m = strlen(mon) == 3 ? strstr(months, mon) : NULL;
+    if (!m || (m - months) % 3) return -1;
+    return days_from_civil(y, (int)(m - months) / 3 + 1, d) * 86400 + hh * 3600 + mm * 60 + ss;
+}
+
+// Retry-After is either delay-seconds or an HTTP-date. A date is measured
+// against the response's own Date header when there is one, so clock skew
+// between us and the server does not matter.
+static int parse_retry_after(const char *hdr_path) {
+    FILE *f = fopen(hdr_path, "r");
+    if (!f) return 0;
+
+    char line[256];
+    long long seconds = 0, retry_at = -1, server_now = -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (strncasecmp(line, "retry-after:", 12) == 0) {
+            const char *value = line + 12;
+            while (*value == ' ') value++;
+            if (isdigit((unsigned char)*value)) {
+                seconds = atoll(value);
+                retry_at = -1;
+            } else {
+                retry_at = parse_http_date(value);
+            }
+        } else if (strncasecmp(line, "date:", 5) == 0) {
+            server_now = parse_http_date(line + 5);
+        }
+    }
+    fclose(f);
+    if (retry_at != -1) seconds = retry_at - (server_now != -1 ? server_now : (long long)time(NULL));
+    return seconds < 0 ? 0 : seconds > RETRY_AFTER_CAP_S ? RETRY_AFTER_CAP_S : (int)seconds;
+}
+
+// One endpoint can only hold config.max_inflight requests at a time across
+// every agent-c process sharing it. Each slot is an fcntl-locked file in /tmp
+// whose lock the kernel drops if the holder dies.
+static int acquire_slot(void) {
+    unsigned long hash = 5381;
+    for (const char *p = config.base_url; *p; p++) hash = hash * 33 + (unsigned char)*p;
+
+    for (;;) {
+        for (int slot = 0; slot < config.max_inflight; slot++) {
+            char path[64];
+            snprintf(path, sizeof(path), "/tmp/agent-c-%08lx.%d", hash & 0xffffffffUL, slot);
+
+            int fd = open(path, O_RDWR | O_CREAT, 0600);
+            if (fd == -1) return -1;
+
+            struct flock lock = { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+            if (fcntl(fd, F_SETLK, &lock) == 0) return fd;
+            close(fd);
+        }
+        if (loop_sleep(50 + rand() % 100) == LOOP_CANCELLED) return -1;
+    }
+}
+
+// Reads what curl has written so far: bytes read, 0 at EOF, LOOP_CANCELLED.
+static ssize_t read_pipe(int fd, char *buf, size_t size) {
+    for (;;) {
+        int rc = loop_wait(fd, -1, 1);
+        if (rc == LOOP_CANCELLED) return LOOP_CANCELLED;
+
+        ssize_t n = read(fd, buf, size);
+        if (n == -1 && errno == EINTR) continue;
+        return n < 0 ? 0 : n;
+    }
+}
+
+static void stream_line(char *line, StreamState *st, int *events, char *resp, size_t resp_size,
+                        ToolReadyFn on_tool) {
+    if (strncmp(line, "data:", 5) != 0) {
+        if (!*events) snprintf(resp + strlen(resp), resp_size - strlen(resp), "%s", line);
+        return;
+    }
+
+    char *data = trim(line + 5);
+    if (strcmp(data, "[DONE]") == 0 || json_stream_delta(data, st) != 0) return;
+    (*events)++;
+
+    for (int i = 0; i < st->tool_count; i++) {
+        if (st->tools[i].ready != 1) continue;
+        st->tools[i].ready = 2;
+
+        char arguments[MAX_CONTENT];
+        json_unescape(st->tools[i].arguments, arguments, sizeof(arguments));
+        on_tool(st->tools[i].name, arguments);
+    }
+}
+
+// Reads an SSE body, reporting each tool call as soon as its arguments are
+// complete. Anything that is not an SSE event (an error body) is kept as-is.
+static int read_stream(int fd, char *resp, size_t resp_size, ToolReadyFn on_tool) {
+    static StreamState st;
+    memset(&st, 0, sizeof(st));
+    resp[0] = '\0';
+
+    char line[MAX_BUFFER];
+    size_t line_len = 0;
+    int events = 0;
+    for (;;) {
+        char chunk[4096];
+        ssize_t n = read_pipe(fd, chunk, sizeof(chunk));
+        if (n == LOOP_CANCELLED) return LOOP_CANCELLED;
+
+        for (ssize_t i = 0; i <= n; i++) {
+            int eof = i == n;
+            if (eof && (n > 0 || !line_len)) break;
+            if (!eof) line[line_len++] = chunk[i];
+            if (!eof && chunk[i] != '\n' && line_len < sizeof(line) - 1) continue;
+
+            line[line_len] = '\0';
+            stream_line(line, &st, &events, resp, resp_size, on_tool);
+            line_len = 0;
+        }
+        if (n == 0) break;
+    }
+
+    if (events) json_stream_response(&st, resp, resp_size);
+    return 0;
+}
+
+static int read_all(int fd, char *resp, size_t resp_size) {
+    size_t used = 0;
+    char drain[1024];
+    for (;;) {
+        int room = used < resp_size - 1;
+        ssize_t n = read_pipe(fd, room ? resp + used : drain, room ? resp_size - 1 - used : sizeof(drain));
+        if (n == LOOP_CANCELLED) return LOOP_CANCELLED;
+        if (n == 0) break;
+        if (room) used += n;
+    }
+    resp[used] = '\0';
+    return 0;
+}
+
+// Writes the request body the way `curl -d` would send it (CR/LF dropped) and
+// compresses it with the external gzip/zstd tool when configured. *encoding
+// is the Content-Encoding to send, or NULL when the body stays uncompressed.
+static int write_body(const char *req, char *path, const char **encoding) {
+    *encoding = NULL;
+    if (make_temp(path, "ai_req")) return -1;
+
+    FILE *f = fopen(path, "w");
+    if (!f) { unlink(path); return -1; }
+    size_t bytes = 0;
+    for (const char *p = req; *p; p++) {
+        if (*p == '\r' || *p == '\n') continue;
+        fputc(*p, f);
+        bytes++;
+    }
+    fclose(f);
+
+    if (bytes < COMPRESS_MIN_BYTES) return 0;
+    if (strcmp(config.compress, "gzip") != 0 && strcmp(config.compress, "zstd") != 0) return 0;
+
+    char packed[72], cmd[256];
+    snprintf(packed, sizeof(packed), "%s.z", path);
+    snprintf(cmd, sizeof(cmd), "%s -q -c '%s' > '%s' 2>/dev/null && mv '%s' '%s'",
+             config.compress, path, packed, packed, path);
+    if (system(cmd) == 0) {
+        *encoding = config.compress;
+    } else {
+        unlink(packed);
+    }
+    return 0;
+}
+
+static void run_attempt(const char *req_path, const char *encoding, char *resp, size_t resp_size,
+                        ToolReadyFn on_tool, int attempt, Attempt *a) {
+    char hdr[64], meta[64];
+    memset(a, 0, sizeof(*a));
+    a->curl_rc = -1;
+    resp[0] = '\0';
+    if (make_temp(hdr, "ai_hdr") || make_temp(meta, "ai_meta")) return;
+
+    int connect_timeout = derive_timeout(&connect_hist, 10, 4.0, 2, 30);
+
+    // --speed-limit/--speed-time abort when no bytes arrive for the given
+    // window. A stream sends its first event once the prompt is read, so
+    // that is bounded by recent first-byte times, doubled on each retry in
+    // case this prompt is just slower. A buffered reply sends nothing until
+    // the whole completion is generated, so its first byte is the whole
+    // reply and --max-time is bounded the same way.
+    char stall[64] = "";
+    int max_time = 600;
+    if (on_tool) {
+        int first_byte_timeout = derive_timeout(&first_byte_hist, 60, 3.0, 10, 120) << attempt;
+        if (first_byte_timeout > 600) first_byte_timeout = 600;
+        snprintf(stall, sizeof(stall), "--speed-limit 1 --speed-time %d ", first_byte_timeout);
+    } else {
+        max_time = derive_timeout(&first_byte_hist, 120, 3.0, 30, 300) << attempt;
+        if (max_time > 600) max_time = 600;
+    }
+
+    char content_encoding[64] = "";
+    if (encoding) snprintf(content_encoding, sizeof(content_encoding), "-H 'Content-Encoding: %s' ", encoding);
+
+    // --compressed sends Accept-Encoding for every codec curl was built with
+    // and decodes the body as it streams in.
+    char curl[MAX_BUFFER];
+    snprintf(curl, sizeof(curl),
+             "curl -s -X POST '%s' -H 'Content-Type: application/json' -H 'Authorization: Bearer %s' %s"
+             "--data-binary @'%s' -D '%s' --connect-timeout %d %s--max-time %d %s%s"
+             "-w '%%{stderr}%%{http_code} %%{time_connect} %%{time_starttransfer}' 2>'%s'",
+             config.base_url, config.api_key, content_encoding, req_path, hdr, connect_timeout, stall, max_time,
+             on_tool ? "-N " : "", config.accept_encoding ? "--compressed " : "", meta);
+
+    // curl runs in its own process group so Ctrl-C cancels just the request.
+    int fd;
+    pid_t pid = loop_spawn(curl, &fd);
+    if (pid != -1) {
+        int rc = on_tool ? read_stream(fd, resp, resp_size, on_tool) : read_all(fd, resp, resp_size);
+        if (rc == LOOP_CANCELLED) {
+            loop_stop_group(pid);
+            a->cancelled = 1;
+        } else {
+            char drain[1024];
+            while (read_pipe(fd, drain, sizeof(drain)) > 0) {}
+        }
+        close(fd);
+
+        int status = 0;
+        while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {}
+        a->curl_rc = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+
+        FILE *f = fopen(meta, "r");
+        if (f) {
+            if (fscanf(f, "%d %lf %lf", &a->http_code, &a->connect_s, &a->first_byte_s) != 3) a->http_code = 0;
+            fclose(f);
+        }
+        a->retry_after_s = parse_retry_after(hdr);
+    }
+
+    unlink(hdr);
+    unlink(meta);
+}
+
+// Chat completion POSTs carry no server-side state, so every request sent
+// through here is treated as idempotent and retried on transient failures.
+// Speculative tool runs from a failed streaming attempt stay valid because
+// only side-effect-free calls are ever started early.
+static int schedule(const char *req, char *resp, size_t resp_size, ToolReadyFn on_tool) {
+    static int seeded;
+    if (!seeded) { srand((unsigned)time(NULL) ^ (unsigned)getpid()); seeded = 1; }
+
+    char temp[64];
+    const char *encoding;
+    if (write_body(req, temp, &encoding)) return -1;
+
+    int slot = acquire_slot();
+
+    ReqClass cls = REQ_FATAL;
+    for (int attempt = 0;; attempt++) {
+        Attempt a;
+        run_attempt(temp, encoding, resp, resp_size, on_tool, attempt, &a);
+        cls = classify(&a);
+
+        if (cls == REQ_CANCELLED) {
+            snprintf(resp, resp_size, "{\"error\":{\"message\":\"Request cancelled by user\"}}");
+            break;
+        }
+
+        if (a.curl_rc == 0 && a.http_code) {
+            hist_add(&connect_hist, a.connect_s * 1000);
+            if (cls == REQ_OK) hist_add(&first_byte_hist, a.first_byte_s * 1000);
+        }
+
+        if (cls == REQ_OK || cls == REQ_FATAL || attempt >= config.max_retries) {
+            if (cls != REQ_OK && !*resp) {
+                snprintf(resp, resp_size, "{\"error\":{\"message\":\"request failed (curl %d, HTTP %d)\"}}",
+                         a.curl_rc, a.http_code);
+            }
+            break;
+        }
+
+        long delay = backoff_ms(attempt);
+        if (cls == REQ_RATE_LIMITED && a.retry_after_s * 1000L > delay) delay = a.retry_after_s * 1000L;
+
+        printf("\033[33m⏳ %s (curl %d, HTTP %d), retrying in %.1fs [%d/%d]\033[0m\n",
+               cls == REQ_RATE_LIMITED ? "Rate limited" : "Transient failure",
+               a.curl_rc, a.http_code, delay / 1000.0, attempt + 1, config.max_retries);
+        fflush(stdout);
+
+        // The slot is given up while backing off so other processes can use
+        // the endpoint in the meantime.
+        if (slot != -1) close(slot);
+        slot = -1;
+        if (loop_sleep(delay) == LOOP_CANCELLED) {
+            cls = REQ_CANCELLED;
+            snprintf(resp, resp_size, "{\"error\":{\"message\":\"Request cancelled by user\"}}");
+            break;
+        }
+        slot = acquire_slot();
+    }
+
+    if (slot != -1) close(slot);
+    unlink(temp);
+    return cls == REQ_OK ? 0 : cls == REQ_CANCELLED ? LOOP_CANCELLED : -1;
+}
+
+int http_request(const char *req, char *resp, size_t resp_size) {
+    return schedule(req, resp, resp_size, NULL);
+}
+
+int http_stream_request(const char *req, char *resp, size_t resp_size, ToolReadyFn on_tool) {
+    return schedule(req, resp, resp_size, on_tool);
+}
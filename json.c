@@ -1,6 +1,7 @@
 #include "agent-c.h"
 #define SJ_IMPL
 #include "sj.h/sj.h"
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -84,7 +85,7 @@ static sj_Value find_by_path(sj_Reader *r, const char *response, const char *pat
     return v;
 }
 
-static char *extract_tool_call_id(const char *tool_calls, char *id, size_t id_size) {
+char *json_tool_call_id(const char *tool_calls, char *id, size_t id_size) {
     sj_Reader tr = sj_reader((char*)tool_calls, strlen(tool_calls));
     sj_Value arr = sj_read(&tr);
     id[0] = '\0';
@@ -99,61 +100,296 @@ static char *extract_tool_call_id(const char *tool_calls, char *id, size_t id_si
     return id;
 }
 
-static char *format_tool_message(const Message *m, char *out, size_t size) {
+static char *format_tool_message(const Message *m, const char *text, char *out, size_t size) {
     char id[64] = "";
-    extract_tool_call_id(m->tool_calls, id, sizeof(id));
+    char content[MAX_CONTENT * 2];
+    json_tool_call_id(m->tool_calls, id, sizeof(id));
     snprintf(out, size, "{\"role\":\"%s\",\"content\":\"%s\",\"tool_call_id\":\"%s\"}",
-             m->role, m->content, id);
+             m->role, json_escape(text, content, sizeof(content)), id);
     return out;
 }
 
 static char *format_assistant_with_tools(const Message *m, char *out, size_t size) {
-    snprintf(out, size,
-             "{\"role\":\"%s\",\"content\":%s,\"tool_calls\":%s}",
-             m->role, m->content[0] ? "\"" : "", m->tool_calls);
-
     if (m->content[0]) {
-        char *comma = strrchr(out, ',');
-        if (comma) memmove(comma, comma - 1, strlen(comma) + 2);
+        char content[MAX_CONTENT * 2];
+        snprintf(out, size, "{\"role\":\"%s\",\"content\":\"%s\",\"tool_calls\":%s}",
+                 m->role, json_escape(m->content, content, sizeof(content)), m->tool_calls);
+    } else {
+        snprintf(out, size, "{\"role\":\"%s\",\"content\":null,\"tool_calls\":%s}",
+                 m->role, m->tool_calls);
     }
     return out;
 }
 
-static char *format_message(const Message *m, char *out, size_t size) {
+// Tool results may go out as a reference or delta instead of m->content;
+// sent_full records which ones went out whole.
+static char *format_message(const Agent *agent, int index, int *sent_full, char *out, size_t size) {
+    const Message *m = &agent->messages[index];
     if (strcmp(m->role, "tool") == 0) {
-        return format_tool_message(m, out, size);
+        char deduped[MAX_CONTENT];
+        const char *text = dedup_content(agent, index, sent_full, deduped, sizeof(deduped));
+        sent_full[index] = text == m->content;
+        return format_tool_message(m, text, out, size);
     } else if (strcmp(m->role, "assistant") == 0 && m->tool_calls[0]) {
         return format_assistant_with_tools(m, out, size);
     } else {
-        snprintf(out, size, "{\"role\":\"%s\",\"content\":\"%s\"}", m->role, m->content);
+        char content[MAX_CONTENT * 2];
+        snprintf(out, size, "{\"role\":\"%s\",\"content\":\"%s\"}",
+                 m->role, json_escape(m->content, content, sizeof(content)));
         return out;
     }
 }
 
-char *json_request(const Agent *agent, const Config *config, char *out, size_t size) {
+static void append_raw(char *dst, size_t size, sj_Value v) {
+    size_t len = strlen(dst), n = v.end - v.start;
+    if (len + n >= size) n = size - len - 1;
+    memcpy(dst + len, v.start, n);
+    dst[len + n] = '\0';
+}
+
+// Arguments are complete once the top-level object closes.
+static int arguments_complete(const char *args) {
+    int depth = 0, in_str = 0;
+    for (const char *p = args; *p; p++) {
+        if (in_str) {
+            if (*p == '\\' && p[1]) p++;
+            else if (*p == '"') in_str = 0;
+        } else if (*p == '"') {
+            in_str = 1;
+        } else if (*p == '{') {
+            depth++;
+        } else if (*p == '}' && --depth == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void stream_tool_delta(sj_Reader *r, sj_Value call, StreamState *st) {
+    sj_Value k, v;
+    sj_Value id = { .type = SJ_ERROR }, name = { .type = SJ_ERROR }, args = { .type = SJ_ERROR };
+    int index = st->tool_count ? st->tool_count - 1 : 0;
+
+    while (sj_iter_object(r, call, &k, &v)) {
+        if (eq(k, "index") && v.type == SJ_NUMBER) {
+            index = atoi(v.start);
+        } else if (eq(k, "id")) {
+            id = v;
+        } else if (eq(k, "function") && v.type == SJ_OBJECT) {
+            sj_Value fk, fv;
+            while (sj_iter_object(r, v, &fk, &fv)) {
+                if (eq(fk, "name")) name = fv;
+                else if (eq(fk, "arguments")) args = fv;
+            }
+        }
+    }
+
+    if (index < 0 || index >= MAX_STREAM_TOOLS) return;
+    if (index >= st->tool_count) st->tool_count = index + 1;
+
+    StreamTool *t = &st->tools[index];
+    if (id.type == SJ_STRING) get_str(id, t->id, sizeof(t->id));
+    if (name.type == SJ_STRING) get_str(name, t->name, sizeof(t->name));
+    if (args.type == SJ_STRING) append_raw(t->arguments, sizeof(t->arguments), args);
+
+    if (!t->ready) {
+        char unescaped[MAX_CONTENT];
+        json_unescape(t->arguments, unescaped, sizeof(unescaped));
+        if (arguments_complete(unescaped)) t->ready = 1;
+    }
+}
+
+int json_stream_delta(const char *chunk, StreamState *st) {
+    sj_Reader r;
+    const char *path[] = {"choices", "0"};
+    sj_Value choice = find_by_path(&r, chunk, path, 2);
+    if (choice.type != SJ_OBJECT) return -1;
+
+    sj_Value k, v;
+    while (sj_iter_object(&r, choice, &k, &v)) {
+        if (eq(k, "finish_reason") && v.type == SJ_STRING) {
+            get_str(v, st->finish_reason, sizeof(st->finish_reason));
+        } else if (eq(k, "delta") && v.type == SJ_OBJECT) {
+            sj_Value dk, dv;
+            while (sj_iter_object(&r, v, &dk, &dv)) {
+                if (eq(dk, "content") && dv.type == SJ_STRING) {
+                    append_raw(st->content, sizeof(st->content), dv);
+                } else if (eq(dk, "tool_calls") && dv.type == SJ_ARRAY) {
+                    sj_Value call;
+                    while (sj_iter_array(&r, dv, &call)) stream_tool_delta(&r, call, st);
+                }
+            }
+        }
+    }
+    return has_error(&r) ? -1 : 0;
+}
+
+// Appends to out without ever moving *p past its last byte.
+static void appendf(char *out, size_t size, char **p, const char *fmt, ...) {
+    size_t used = *p - out;
+    if (used >= size - 1) return;
+
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(*p, size - used, fmt, ap);
+    va_end(ap);
+    if (n > 0) *p += (size_t)n < size - used ? (size_t)n : size - used - 1;
+}
+
+// Rebuilds a non-streaming response so the rest of the agent sees one shape.
+char *json_stream_response(const StreamState *st, char *out, size_t size) {
+    char *p = out;
+    appendf(out, size, &p, "{\"choices\":[{\"index\":0,\"message\":{\"role\":\"assistant\",\"content\":");
+    if (st->content[0] || !st->tool_count) {
+        appendf(out, size, &p, "\"%s\"", st->content);
+    } else {
+        appendf(out, size, &p, "null");
+    }
+
+    if (st->tool_count) {
+        appendf(out, size, &p, ",\"tool_calls\":[");
+        for (int i = 0; i < st->tool_count; i++) {
+            const StreamTool *t = &st->tools[i];
+            appendf(out, size, &p,
+                    "%s{\"id\":\"%s\",\"type\":\"function\",\"function\":{\"name\":\"%s\",\"arguments\":\"%s\"}}",
+                    i ? "," : "", t->id, t->name, t->arguments);
+        }
+        appendf(out, size, &p, "]");
+    }
+
+    appendf(out, size, &p, "},\"finish_reason\":\"%s\"}]}", st->finish_reason);
+    return out;
+}
+
+char *json_unescape(const char *raw, char *out, size_t size) {
+    sj_Value v = { .type = SJ_STRING, .start = (char*)raw, .end = (char*)raw + strlen(raw) };
+    return get_str(v, out, size);
+}
+
+char *json_escape(const char *str, char *out, size_t size) {
+    char *dst = out, *end = out + size - 1;
+    for (const char *src = str; *src && dst < end; src++) {
+        const char *esc = NULL;
+        switch (*src) {
+        case '"': esc = "\\\""; break;
+        case '\\': esc = "\\\\"; break;
+        case '\n': esc = "\\n"; break;
+        case '\t': esc = "\\t"; break;
+        case '\r': esc = "\\r"; break;
+        }
+        if (!esc) {
+            if ((unsigned char)*src >= 0x20) *dst++ = *src;
+            continue;
+        }
+        if (dst + 2 > end) break;
+        *dst++ = esc[0];
+        *dst++ = esc[1];
+    }
+    *dst = '\0';
+    return out;
+}
+
+static int is_flag_name(const char *key) {
+    for (const char *c = key; *c; c++) {
+        if (!((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9') ||
+              *c == '_' || *c == '-')) return 0;
+    }
+    return *key != '\0';
+}
+
+// Turns a tool call's arguments object into " --key 'value'" flags for a
+// skill script. Values are single-quoted for the shell; false booleans and
+// nulls are dropped and true booleans become bare flags.
+int json_args_to_flags(const char *arguments, char *out, size_t size) {
+    out[0] = '\0';
+    sj_Reader r = sj_reader((char*)arguments, strlen(arguments));
+    sj_Value obj = sj_read(&r);
+    if (obj.type != SJ_OBJECT || r.error) return 0;
+
+    size_t used = 0;
+    sj_Value k, v;
+    while (sj_iter_object(&r, obj, &k, &v)) {
+        char key[MAX_SKILL_NAME], value[MAX_SKILL_PATH], quoted[MAX_SKILL_PATH * 4];
+        if (!get_str(k, key, sizeof(key)) || !is_flag_name(key)) continue;
+
+        if (v.type == SJ_BOOL || v.type == SJ_NULL) {
+            if (*v.start != 't') continue;
+            quoted[0] = '\0';
+        } else {
+            if (v.type == SJ_STRING) {
+                get_str(v, value, sizeof(value));
+            } else if (v.type == SJ_NUMBER) {
+                snprintf(value, sizeof(value), "%.*s", (int)(v.end - v.start), v.start);
+            } else {
+                continue;
+            }
+
+            char *q = quoted;
+            *q++ = ' ';
+            *q++ = '\'';
+            for (const char *c = value; *c; c++) {
+                if (*c == '\'') { memcpy(q, "'\\''", 4); q += 4; }
+                else *q++ = *c;
+            }
+            *q++ = '\'';
+            *q = '\0';
+        }
+
+        int n = snprintf(out + used, size - used, " --%s%s", key, quoted);
+        if (n < 0 || used + n >= size) {
+            out[used] = '\0';
+            break;
+        }
+        used += n;
+    }
+    return !has_error(&r);
+}
+
+int json_arg(const char *arguments, const char *key, char *out, size_t size) {
+    sj_Reader r = sj_reader((char*)arguments, strlen(arguments));
+    sj_Value obj = sj_read(&r);
+    if (obj.type != SJ_OBJECT || r.error) return 0;
+
+    // Numbers and booleans come back as their literal text.
+    sj_Value v = find_in_obj(&r, obj, key);
+    if (v.type == SJ_NUMBER || v.type == SJ_BOOL) {
+        snprintf(out, size, "%.*s", (int)(v.end - v.start), v.start);
+        return 1;
+    }
+    return get_str(v, out, size) && *out;
+}
+
+char *json_request(const Agent *agent, const Config *config, const char *model, char *out, size_t size) {
     static const char *tools =
-        "[{\"type\":\"function\",\"function\":{\"name\":\"execute_command\",\"description\":\"Execute shell command\",\"parameters\":{\"type\":\"object\",\"properties\":{\"command\":{\"type\":\"string\"}},\"required\":[\"command\"]}}},"
+        "{\"type\":\"function\",\"function\":{\"name\":\"execute_command\",\"description\":\"Execute shell command\",\"parameters\":{\"type\":\"object\",\"properties\":{\"command\":{\"type\":\"string\"}},\"required\":[\"command\"]}}},"
+        "{\"type\":\"function\",\"function\":{\"name\":\"read_file\",\"description\":\"Read a text file without the shell, by line range (start_line, max_lines) or byte range (offset, length). Output is paginated and says where to continue.\",\"parameters\":{\"type\":\"object\",\"properties\":{\"path\":{\"type\":\"string\"},\"start_line\":{\"type\":\"integer\"},\"max_lines\":{\"type\":\"integer\"},\"offset\":{\"type\":\"integer\"},\"length\":{\"type\":\"integer\"}},\"required\":[\"path\"]}}},"
+        "{\"type\":\"function\",\"function\":{\"name\":\"list_dir\",\"description\":\"List a directory with type, permissions, size and modification time, sorted by name and paginated.\",\"parameters\":{\"type\":\"object\",\"properties\":{\"path\":{\"type\":\"string\"},\"offset\":{\"type\":\"integer\"},\"limit\":{\"type\":\"integer\"}}}}},"
+        "{\"type\":\"function\",\"function\":{\"name\":\"grep\",\"description\":\"Search files under path (default .) for an extended regular expression. Skips binary files, symlinks and dot-directories; include is a file name glob such as *.c. Matches are paginated.\",\"parameters\":{\"type\":\"object\",\"properties\":{\"pattern\":{\"type\":\"string\"},\"path\":{\"type\":\"string\"},\"include\":{\"type\":\"string\"},\"ignore_case\":{\"type\":\"boolean\"},\"offset\":{\"type\":\"integer\"},\"limit\":{\"type\":\"integer\"}},\"required\":[\"pattern\"]}}},"
         "{\"type\":\"function\",\"function\":{\"name\":\"extract_skill\",\"description\":\"Extract content from SKILL.md file\",\"parameters\":{\"type\":\"object\",\"properties\":{\"skill_name\":{\"type\":\"string\"}},\"required\":[\"skill_name\"]}}},"
-        "{\"type\":\"function\",\"function\":{\"name\":\"execute_skill\",\"description\":\"Execute skill script with format: 'skill_name script_name [arguments]'. Script name should not include file extension.\",\"parameters\":{\"type\":\"object\",\"properties\":{\"skill_command\":{\"type\":\"string\"}},\"required\":[\"skill_command\"]}}}]";
+        "{\"type\":\"function\",\"function\":{\"name\":\"execute_skill\",\"description\":\"Execute skill script with format: 'skill_name script_name [arguments]'. Script name should not include file extension.\",\"parameters\":{\"type\":\"object\",\"properties\":{\"skill_command\":{\"type\":\"string\"}},\"required\":[\"skill_command\"]}}}";
+
+    const char *script_tools = skill_tools();
 
     char *p = out;
 
-    p += snprintf(p, size - (p - out),
-                  "{\"model\":\"%s\",\"temperature\":%g,\"max_tokens\":%d,\"stream\":false,"
-                  "\"tool_choice\":\"auto\",\"tools\":%s,\"messages\":[",
-                  config->model, config->temp, config->max_tokens, tools);
+    appendf(out, size, &p,
+            "{\"model\":\"%s\",\"temperature\":%g,\"max_tokens\":%d,\"stream\":%s,"
+            "\"tool_choice\":\"auto\",\"tools\":[%s%s%s],\"messages\":[",
+            model, config->temp, config->max_tokens, config->speculate ? "true" : "false",
+            tools, *script_tools ? "," : "", script_tools);
 
+    int sent_full[MAX_MESSAGES] = {0};
     for (int i = 0; i < agent->msg_count; i++) {
-        if (i) p += snprintf(p, size - (p - out), ",");
-        char msg_buf[MAX_CONTENT];
-        p += snprintf(p, size - (p - out), "%s", format_message(&agent->messages[i], msg_buf, sizeof(msg_buf)));
+        if (i) appendf(out, size, &p, ",");
+        char msg_buf[MAX_CONTENT * 3];
+        appendf(out, size, &p, "%s", format_message(agent, i, sent_full, msg_buf, sizeof(msg_buf)));
     }
 
-    p += snprintf(p, size - (p - out), "]");
+    appendf(out, size, &p, "]");
     if (config->op_providers_on && config->op_providers_json[0]) {
-        p += snprintf(p, size - (p - out), ",\"provider\":%s", config->op_providers_json);
+        appendf(out, size, &p, ",\"provider\":%s", config->op_providers_json);
     }
-    snprintf(p, size - (p - out), "}");
+    appendf(out, size, &p, "}");
 
     return out;
 }
@@ -249,6 +485,12 @@ int extract_tool_calls(const char *response, char *output, size_t output_size, c
             get_str(id, output, output_size);
             return strlen(output) > 0;
         }
+        else if (strcmp(type, "name") == 0 || strcmp(type, "arguments") == 0) {
+            sj_Value function = find_in_obj(&r, tool_call, "function");
+            sj_Value value = find_in_obj(&r, function, type);
+            if (!get_str(value, output, output_size)) return 0;
+            return *output > 0;
+        }
         else if (strcmp(type, "param") == 0) {
             sj_Value function = find_in_obj(&r, tool_call, "function");
             sj_Value name = find_in_obj(&r, function, "name");
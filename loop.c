@@ -0,0 +1,276 @@
+#include "agent-c.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/wait.h>
+
+// Event loop core. Every blocking wait in the agent (curl output, the session
+// shell, skill workers, child processes, retry backoff, the prompt) goes
+// through loop_wait(), which polls the awaited fd together with a self-pipe
+// fed by the SIGINT and SIGCHLD handlers and with the terminal. Ctrl-C during
+// a turn therefore cancels only the operation in flight; at an idle prompt it
+// still ends the session. Lines typed while a turn is running are buffered
+// and become the next prompt input.
+
+static int wake[2] = {-1, -1};
+static volatile sig_atomic_t cancel_requested;
+static int busy;
+
+static char typeahead[MAX_BUFFER];
+static size_t typeahead_len;
+static int stdin_eof;
+
+static void on_signal(int sig) {
+    int saved = errno;
+    char byte = sig == SIGINT ? 'i' : 'c';
+    if (sig == SIGINT) cancel_requested = 1;
+    write(wake[1], &byte, 1);
+    errno = saved;
+}
+
+// Also called in forked children so they stop sharing the parent's pipe.
+void loop_init(void) {
+    if (wake[0] != -1) {
+        close(wake[0]);
+        close(wake[1]);
+    }
+    if (pipe(wake) == -1) {
+        wake[0] = wake[1] = -1;
+        return;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(wake[i], F_SETFL, fcntl(wake[i], F_GETFL) | O_NONBLOCK);
+        fcntl(wake[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    // No SA_RESTART for SIGINT so blocking calls return EINTR; SIGCHLD must
+    // not disturb anything but the loop.
+    struct sigaction sa = { .sa_handler = on_signal };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &sa, NULL);
+    cancel_requested = 0;
+}
+
+void loop_begin(void) {
+    busy = 1;
+    cancel_requested = 0;
+}
+
+void loop_end(void) {
+    busy = 0;
+    cancel_requested = 0;
+}
+
+int loop_cancelled(void) {
+    return cancel_requested;
+}
+
+static long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+static void read_typeahead(void) {
+    ssize_t n = read(STDIN_FILENO, typeahead + typeahead_len, sizeof(typeahead) - 1 - typeahead_len);
+    if (n > 0) typeahead_len += n;
+    else if (n == 0 || errno != EINTR) stdin_eof = 1;
+}
+
+// Waits until fd is readable, a child exits (fd == -1 only), timeout_ms
+// passes (-1: no limit) or, if cancellable, the user presses Ctrl-C.
+// Returns 1, 0 on timeout, LOOP_CANCELLED or -1 on error.
+int loop_wait(int fd, int timeout_ms, int cancellable) {
+    long deadline = timeout_ms < 0 ? -1 : now_ms() + timeout_ms;
+
+    for (;;) {
+        if (cancellable && cancel_requested) return LOOP_CANCELLED;
+
+        struct pollfd pfds[3] = {
+            { .fd = wake[0], .events = POLLIN },
+            { .fd = fd, .events = POLLIN },
+            { .fd = -1, .events = POLLIN },
+        };
+        if (busy && !stdin_eof && typeahead_len < sizeof(typeahead) - 1) pfds[2].fd = STDIN_FILENO;
+
+        int wait_ms = -1;
+        if (deadline >= 0) {
+            long left = deadline - now_ms();
+            if (left <= 0) return 0;
+            wait_ms = (int)left;
+        }
+
+        int ready = poll(pfds, 3, wait_ms);
+        if (ready == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (ready == 0) return 0;
+
+        if (pfds[2].revents) read_typeahead();
+        if (pfds[1].revents) return 1;
+        if (pfds[0].revents) {
+            char drain[64];
+            int child = 0;
+            ssize_t n;
+            while ((n = read(wake[0], drain, sizeof(drain))) > 0) {
+                if (memchr(drain, 'c', n)) child = 1;
+            }
+            if (fd == -1 && child) return 1;
+        }
+    }
+}
+
+static int has_exited(pid_t pid) {
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    if (waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == -1) return errno == ECHILD;
+    return info.si_pid == pid;
+}
+
+// Waits for pid to exit without reaping it. Same returns as loop_wait().
+int loop_wait_pid(pid_t pid, int timeout_ms, int cancellable) {
+    long deadline = timeout_ms < 0 ? -1 : now_ms() + timeout_ms;
+    for (;;) {
+        if (has_exited(pid)) return 1;
+
+        int left = -1;
+        if (deadline >= 0 && (left = (int)(deadline - now_ms())) <= 0) return 0;
+
+        int rc = loop_wait(-1, left, cancellable);
+        if (rc == LOOP_CANCELLED || rc == -1) return rc;
+    }
+}
+
+// SIGINT to the group first, like a terminal Ctrl-C would; SIGKILL if the
+// leader is still running after the grace period. The caller reaps it.
+void loop_stop_group(pid_t pgid) {
+    kill(-pgid, SIGINT);
+    if (loop_wait_pid(pgid, LOOP_GRACE_MS, 0) != 1) kill(-pgid, SIGKILL);
+}
+
+// Runs cmd through /bin/sh in its own process group with stdin on /dev/null.
+// If out_fd is given, it receives the read end of the child's stdout.
+pid_t loop_spawn(const char *cmd, int *out_fd) {
+    int out[2] = {-1, -1};
+    if (out_fd && pipe(out) == -1) return -1;
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == -1) {
+        if (out_fd) { close(out[0]); close(out[1]); }
+        return -1;
+    }
+
+    if (pid == 0) {
+        setpgid(0, 0);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGCHLD, SIG_DFL);
+        int null = open("/dev/null", O_RDONLY);
+        if (null != -1) {
+            dup2(null, STDIN_FILENO);
+            close(null);
+        }
+        if (out_fd) {
+            dup2(out[1], STDOUT_FILENO);
+            close(out[0]);
+            close(out[1]);
+        }
+        execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+        _exit(127);
+    }
+
+    setpgid(pid, pid);
+    if (out_fd) {
+        close(out[1]);
+        fcntl(out[0], F_SETFD, FD_CLOEXEC);
+        *out_fd = out[0];
+    }
+    return pid;
+}
+
+// Forks a child in its own process group, joined to the caller by two pipes.
+// Returns 0 in the child, the child's pid in the parent or -1. The child gets
+// the read end of its input in *in_fd and the write end of its output in
+// *out_fd; the parent gets the other two ends, closed on exec.
+pid_t loop_fork_piped(int *in_fd, int *out_fd) {
+    int in[2], out[2];
+    if (pipe(in) == -1) return -1;
+    if (pipe(out) == -1) {
+        close(in[0]);
+        close(in[1]);
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        close(in[0]); close(in[1]);
+        close(out[0]); close(out[1]);
+        return -1;
+    }
+
+    if (pid == 0) {
+        setpgid(0, 0);
+        close(in[1]);
+        close(out[0]);
+        *in_fd = in[0];
+        *out_fd = out[1];
+        return 0;
+    }
+
+    // Also set the group here so a kill(-pid) right after fork cannot miss.
+    setpgid(pid, pid);
+    close(in[0]);
+    close(out[1]);
+    fcntl(in[1], F_SETFD, FD_CLOEXEC);
+    fcntl(out[0], F_SETFD, FD_CLOEXEC);
+    *in_fd = in[1];
+    *out_fd = out[0];
+    return pid;
+}
+
+// Cancellable sleep; returns LOOP_CANCELLED if interrupted, else 0.
+int loop_sleep(long ms) {
+    long deadline = now_ms() + ms;
+    for (long left = ms; left > 0; left = deadline - now_ms()) {
+        if (loop_wait(-1, (int)left, 1) == LOOP_CANCELLED) return LOOP_CANCELLED;
+    }
+    return 0;
+}
+
+// Reads one prompt line, serving type-ahead first. Returns 1 for a line, 0 at
+// end of input and LOOP_CANCELLED for Ctrl-C at the prompt.
+int loop_readline(char *line, size_t size) {
+    for (;;) {
+        char *nl = memchr(typeahead, '\n', typeahead_len);
+        if (nl || (stdin_eof && typeahead_len) || typeahead_len == sizeof(typeahead) - 1) {
+            size_t len = nl ? (size_t)(nl - typeahead) : typeahead_len;
+            size_t used = nl ? len + 1 : len;
+            snprintf(line, size, "%.*s", (int)len, typeahead);
+            memmove(typeahead, typeahead + used, typeahead_len - used);
+            typeahead_len -= used;
+            return 1;
+        }
+        if (stdin_eof) return 0;
+
+        if (cancel_requested) {
+            cancel_requested = 0;
+            return LOOP_CANCELLED;
+        }
+
+        struct pollfd pfds[2] = {
+            { .fd = wake[0], .events = POLLIN },
+            { .fd = STDIN_FILENO, .events = POLLIN },
+        };
+        if (poll(pfds, 2, -1) == -1 && errno != EINTR) return 0;
+
+        if (pfds[0].revents) {
+            char drain[64];
+            while (read(wake[0], drain, sizeof(drain)) > 0) {}
+        }
+        if (pfds[1].revents) read_typeahead();
+    }
+}
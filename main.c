@@ -5,11 +5,12 @@ Config config;
 
 void cleanup(int sig) {
     (void)sig;
+    shell_close();
+    worker_close();
     exit(0);
 }
 
 int main(void) {
-    signal(SIGINT, cleanup);
     signal(SIGTERM, cleanup);
 
     load_config();
@@ -19,8 +20,17 @@ int main(void) {
         return 1;
     }
 
+    loop_init();
+    archive_open();
     init_agent();
     run_cli();
+    if (config.show_usage) {
+        usage_summary();
+        route_summary();
+    }
+    archive_close();
+    shell_close();
+    worker_close();
 
     return 0;
 }
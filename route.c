@@ -0,0 +1,122 @@
+#include "agent-c.h"
+#include <ctype.h>
+
+extern Config config;
+
+// Per-request model routing. With AGENTC_FAST_MODEL and AGENTC_STRONG_MODEL
+// set to different models, each request picks one from cheap local signals:
+// new tasks, failed tools, large prompts and long tool chains go to the
+// strong model, while tool-result acknowledgements and short follow-ups go
+// to the fast one. Latency is tracked per model, and a fast model that is
+// failing or has become slower than the strong one is bypassed for a while.
+// A failed or refused fast answer is retried once on the strong model.
+
+#define ROUTE_ALPHA 0.3
+#define ROUTE_SHORT_TASK 160
+#define ROUTE_DEEP_STREAK 3
+#define ROUTE_MAX_FAILURES 2
+#define ROUTE_COOLDOWN 5
+
+typedef struct {
+    double latency;
+    int samples;
+    int requests;
+    int failures;
+    int escalations;
+} ModelStats;
+
+static ModelStats fast_stats, strong_stats;
+static int fast_cooldown;
+
+int route_enabled(void) {
+    return strcmp(config.fast_model, config.strong_model) != 0;
+}
+
+static int is_fast(const char *model) {
+    return strcmp(model, config.fast_model) == 0;
+}
+
+// Only trusted once both models have a few samples.
+static int fast_is_slower(void) {
+    return fast_stats.samples >= 2 && strong_stats.samples >= 2 && fast_stats.latency > strong_stats.latency;
+}
+
+const char *route_select(const RouteSignals *s) {
+    if (!route_enabled()) return config.model;
+
+    int cooling = fast_cooldown > 0 ? fast_cooldown-- : 0;
+    const char *why = NULL;
+    if (s->tool_failed) why = "tool failed";
+    else if (s->prompt_bytes > (size_t)config.route_big_prompt) why = "large prompt";
+    else if (s->tool_streak >= ROUTE_DEEP_STREAK) why = "deep tool chain";
+    else if (!s->tool_round && (!s->follow_up || s->task_len > ROUTE_SHORT_TASK)) why = "new task";
+    else if (cooling) why = "fast model failing";
+    else if (fast_is_slower()) why = "fast model slower";
+
+    const char *model = why ? config.strong_model : config.fast_model;
+    if (!why) why = s->tool_round ? "tool result" : "short follow-up";
+    if (config.show_usage) printf("\033[2m🧭 %s (%s)\033[0m\n", model, why);
+    return model;
+}
+
+// Records one finished request. Cancelled requests are not observed.
+void route_observe(const char *model, double seconds, int ok) {
+    if (!route_enabled()) return;
+
+    ModelStats *st = is_fast(model) ? &fast_stats : &strong_stats;
+    st->requests++;
+    if (!ok) {
+        if (++st->failures >= ROUTE_MAX_FAILURES && st == &fast_stats) {
+            fast_cooldown = ROUTE_COOLDOWN;
+            st->failures = 0;
+        }
+        return;
+    }
+
+    st->failures = 0;
+    st->latency = st->samples++ ? st->latency + ROUTE_ALPHA * (seconds - st->latency) : seconds;
+}
+
+// The model to retry with after model failed or refused, or NULL.
+const char *route_escalation(const char *model) {
+    if (!route_enabled() || !is_fast(model)) return NULL;
+    fast_stats.escalations++;
+    return config.strong_model;
+}
+
+// A response without tool calls whose text is empty or opens with a refusal.
+// Only the first sentence or so is checked; later hedges are normal prose.
+int route_refused(const char *resp) {
+    if (has_tool_call(resp)) return 0;
+
+    char content[MAX_CONTENT];
+    if (!json_content(resp, content, sizeof(content))) return 0;
+
+    char head[64];
+    size_t len = 0;
+    for (const char *p = trim(content); *p && len < sizeof(head) - 1; p++) {
+        head[len++] = tolower((unsigned char)*p);
+    }
+    head[len] = '\0';
+    if (!len) return 1;
+
+    static const char *refusals[] = {
+        "i can't", "i can’t", "i cannot", "i'm unable", "i am unable", "i'm not able",
+        "i am not able", "i won't", "i'm sorry, but", "sorry, but i", "as an ai", NULL
+    };
+    for (int i = 0; refusals[i]; i++) {
+        if (strstr(head, refusals[i])) return 1;
+    }
+    return 0;
+}
+
+void route_summary(void) {
+    if (!route_enabled()) return;
+
+    printf("\033[36m🧭 Model routing this session\033[0m\n");
+    printf("%-6s %-32s %8s %9s %11s\n", "route", "model", "requests", "latency s", "escalated");
+    printf("%-6s %-32.32s %8d %9.2f %11d\n", "fast", config.fast_model, fast_stats.requests,
+           fast_stats.latency, fast_stats.escalations);
+    printf("%-6s %-32.32s %8d %9.2f %11s\n", "strong", config.strong_model, strong_stats.requests,
+           strong_stats.latency, "-");
+}
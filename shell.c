@@ -0,0 +1,201 @@
+#include "agent-c.h"
+#include <time.h>
+#include <errno.h>
+#include <sys/wait.h>
+
+extern Config config;
+
+// Distinct from LOOP_CANCELLED, so a hung command is not taken for Ctrl-C.
+#define READ_TIMEOUT -3
+
+// One long-lived /bin/sh per session, driven over pipes. Each command is
+// followed by a sentinel line carrying its exit status and the shell's
+// working directory, so cd, exports and activated environments persist
+// between tool calls. A command that outlives config.cmd_timeout takes the
+// shell down with it; the next command starts a fresh one in the last
+// known directory. Ctrl-C interrupts only the running command: the shell
+// traps SIGINT and survives it.
+
+static pid_t shell_pid;
+static int shell_in = -1, shell_out = -1;
+static char sentinel[48];
+static char shell_dir[MAX_SKILL_PATH];
+
+// Kills the shell and anything it started; returns the shell's exit status.
+static int shell_stop(void) {
+    int status = 0;
+    if (shell_pid > 0) {
+        kill(-shell_pid, SIGKILL);
+        if (waitpid(shell_pid, &status, 0) == shell_pid) {
+            status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        }
+    }
+    if (shell_in != -1) close(shell_in);
+    if (shell_out != -1) close(shell_out);
+    shell_pid = 0;
+    shell_in = shell_out = -1;
+    return status;
+}
+
+static int shell_start(void) {
+    int in, out;
+    pid_t pid = loop_fork_piped(&in, &out);
+    if (pid == -1) return -1;
+
+    if (pid == 0) {
+        dup2(in, STDIN_FILENO);
+        dup2(out, STDOUT_FILENO);
+        dup2(out, STDERR_FILENO);
+        close(in);
+        close(out);
+        if (*shell_dir) chdir(shell_dir);
+        execl("/bin/sh", "sh", (char *)NULL);
+        _exit(127);
+    }
+
+    shell_pid = pid;
+    shell_in = in;
+    shell_out = out;
+    snprintf(sentinel, sizeof(sentinel), "__agentc_%d_%lx__", (int)pid, (unsigned long)time(NULL));
+
+    // A trap (unlike an ignored signal) is reset in the commands it runs.
+    const char *trap = "trap ':' INT\n";
+    return write_all(shell_in, trap, strlen(trap));
+}
+
+// Sends `eval '<cmd>'` so that a syntax error fails the command instead of
+// leaving the shell waiting for the rest of an unterminated construct.
+static int send_command(const char *cmd) {
+    char script[MAX_BUFFER * 2];
+    size_t len = snprintf(script, sizeof(script), "eval '");
+    for (const char *c = cmd; *c && len < sizeof(script) - 128; c++) {
+        if (*c == '\'') {
+            memcpy(script + len, "'\\''", 4);
+            len += 4;
+        } else {
+            script[len++] = *c;
+        }
+    }
+    len += snprintf(script + len, sizeof(script) - len,
+                    "' </dev/null 2>&1\nprintf '\\n%s %%d %%s\\n' \"$?\" \"$PWD\"\n", sentinel);
+    return write_all(shell_in, script, len);
+}
+
+static void append(char *result, size_t result_size, size_t *used, const char *data, size_t len) {
+    if (*used + len >= result_size) len = result_size - 1 - *used;
+    memcpy(result + *used, data, len);
+    *used += len;
+    result[*used] = '\0';
+}
+
+// Appends output to result until the sentinel arrives (0). Returns -1 if the
+// shell died, READ_TIMEOUT after timeout_ms (-1 for none) and LOOP_CANCELLED
+// on Ctrl-C.
+static int read_until_sentinel(char *result, size_t result_size, int *status, long timeout_ms, int cancellable) {
+    char line[MAX_BUFFER];
+    size_t line_len = 0, used = strlen(result), sentinel_len = strlen(sentinel);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (;;) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long elapsed_ms = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+        long remaining_ms = timeout_ms - elapsed_ms;
+        int ready = timeout_ms < 0 ? loop_wait(shell_out, -1, cancellable) :
+                    remaining_ms > 0 ? loop_wait(shell_out, (int)remaining_ms, cancellable) : 0;
+        if (ready != 1) {
+            append(result, result_size, &used, line, line_len);
+            return ready == 0 ? READ_TIMEOUT : ready == LOOP_CANCELLED ? LOOP_CANCELLED : -1;
+        }
+
+        char chunk[4096];
+        ssize_t n = read(shell_out, chunk, sizeof(chunk));
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) {
+            append(result, result_size, &used, line, line_len);
+            return -1;
+        }
+
+        for (ssize_t i = 0; i < n; i++) {
+            line[line_len++] = chunk[i];
+            if (chunk[i] != '\n' && line_len < sizeof(line) - 1) continue;
+
+            line[line_len] = '\0';
+            if (strncmp(line, sentinel, sentinel_len) == 0 && line[sentinel_len] == ' ') {
+                char *dir = NULL;
+                *status = (int)strtol(line + sentinel_len + 1, &dir, 10);
+                if (dir && *dir == ' ') {
+                    dir[strcspn(dir, "\n")] = '\0';
+                    snprintf(shell_dir, sizeof(shell_dir), "%s", dir + 1);
+                }
+                // Drop the newline the sentinel printf put before itself.
+                if (used && used < result_size - 1 && result[used - 1] == '\n') result[--used] = '\0';
+                return 0;
+            }
+
+            append(result, result_size, &used, line, line_len);
+            line_len = 0;
+        }
+    }
+}
+
+static void append_note(char *result, size_t result_size, const char *note) {
+    size_t len = strlen(result);
+    snprintf(result + len, result_size - len, "%s%s", len && result[len - 1] != '\n' ? "\n" : "", note);
+}
+
+// Runs cmd in the session shell. Returns -1 if no shell could be started,
+// otherwise 0 with *status set to the command's exit status.
+int shell_exec(const char *cmd, char *result, size_t result_size, int *status, ToolUsage *usage) {
+    if (!shell_pid && shell_start() != 0) return -1;
+    usage_begin(shell_pid, usage);
+
+    if (send_command(cmd) != 0) {
+        shell_stop();
+        if (shell_start() != 0) return -1;
+        usage_begin(shell_pid, usage);
+        if (send_command(cmd) != 0) return -1;
+    }
+
+    *status = -1;
+    result[0] = '\0';
+    int rc = read_until_sentinel(result, result_size, status, cmd_timeout_ms(), 1);
+
+    // Interrupt the command the way a terminal would and give it a moment to
+    // unwind; a command that ignores SIGINT takes the shell down with it.
+    int cancelled = rc == LOOP_CANCELLED;
+    if (cancelled) {
+        kill(-shell_pid, SIGINT);
+        rc = read_until_sentinel(result, result_size, status, 2000, 0);
+        if (rc == READ_TIMEOUT) rc = -1;
+    }
+
+    // The shell's peak RSS says nothing about the command it ran.
+    usage_end(shell_pid, usage);
+    usage->maxrss_kb = -1;
+    if (rc == READ_TIMEOUT) {
+        shell_stop();
+        char note[64];
+        snprintf(note, sizeof(note), "[command timed out after %ds; shell restarted]", config.cmd_timeout);
+        append_note(result, result_size, note);
+        *status = 124;
+    } else if (rc == -1) {
+        *status = shell_stop();
+    }
+
+    if (cancelled) {
+        append_note(result, result_size, "[command cancelled by user]");
+        *status = 130;
+    }
+
+    usage->status = *status;
+
+    // Follow the shell so skills and speculative runs see the same directory.
+    if (*shell_dir) chdir(shell_dir);
+    return 0;
+}
+
+void shell_close(void) {
+    shell_stop();
+}
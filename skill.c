@@ -1,6 +1,9 @@
 #include "agent-c.h"
 #include <sys/stat.h>
 #include <dirent.h>
+#include <math.h>
+
+extern Config config;
 
 static int file_exists(const char *path) {
     struct stat st;
@@ -52,10 +55,11 @@ static int extract_skill_description(const char *skill_name, char *description,
     while (fgets(line, sizeof(line), file) && !found_description) {
         line[strcspn(line, "\n")] = '\0';
 
-        if (!*line || line[0] == '#') continue;
+        if (!*line || line[0] == '#' || strcmp(line, "---") == 0) continue;
 
         char *desc_pos = strstr(line, "Description:");
         if (!desc_pos) desc_pos = strstr(line, "DESCRIPTION:");
+        if (!desc_pos) desc_pos = strstr(line, "description:");
 
         if (desc_pos) {
             char *desc_start = desc_pos + (desc_pos[10] == ':' ? 11 : 12);
@@ -75,11 +79,355 @@ static int extract_skill_description(const char *skill_name, char *description,
     return 0;
 }
 
+// Skills discovered at startup. Each entry caches the tool definitions
+// generated from the "script:" lines in its SKILL.md front matter.
+typedef struct {
+    char name[MAX_SKILL_NAME];
+    char description[MAX_SKILL_PATH];
+    char tools[MAX_CONTENT];
+    int length;
+} Skill;
+
+static Skill *skills;
+static int skill_total, skill_capacity;
+static char tools_cache[MAX_SKILL_TOOLS];
+
+// Inverted index over skill names, descriptions and SKILL.md bodies, built
+// once by discover_skills() and ranked with BM25 for every task. The term
+// table doubles whenever it gets half full and the postings grow with it.
+#define MIN_TERM_SLOTS 4096
+#define MIN_POSTINGS 16384
+#define BM25_K1 1.2
+#define BM25_B 0.75
+#define NAME_WEIGHT 3
+
+typedef struct {
+    char term[MAX_TERM];
+    int first;
+} Term;
+
+typedef struct {
+    int skill;
+    int tf;
+    int next;
+} Posting;
+
+static Term *terms;
+static unsigned term_slots, term_count;
+static Posting *postings;
+static int posting_count, posting_capacity;
+static long indexed_terms;
+
+static Term *term_slot(Term *table, unsigned slots, const char *term) {
+    unsigned hash = 2166136261u;
+    for (const char *p = term; *p; p++) hash = (hash ^ (unsigned char)*p) * 16777619u;
+
+    for (unsigned i = 0;; i++) {
+        Term *t = &table[(hash + i) & (slots - 1)];
+        if (!t->term[0] || strcmp(t->term, term) == 0) return t;
+    }
+}
+
+static int grow_terms(void) {
+    unsigned slots = term_slots ? term_slots * 2 : MIN_TERM_SLOTS;
+    Term *grown = calloc(slots, sizeof(Term));
+    if (!grown) return -1;
+    for (unsigned i = 0; i < term_slots; i++) {
+        if (terms[i].term[0]) *term_slot(grown, slots, terms[i].term) = terms[i];
+    }
+    free(terms);
+    terms = grown;
+    term_slots = slots;
+    return 0;
+}
+
+static Term *find_term(const char *term, int create) {
+    if (!term_slots) return NULL;
+    Term *t = term_slot(terms, term_slots, term);
+    if (t->term[0] || !create) return t->term[0] ? t : NULL;
+
+    if ((term_count + 1) * 2 > term_slots) {
+        if (grow_terms() != 0) return NULL;
+        t = term_slot(terms, term_slots, term);
+    }
+    snprintf(t->term, sizeof(t->term), "%s", term);
+    t->first = -1;
+    term_count++;
+    return t;
+}
+
+static int add_posting(int skill, int next) {
+    if (posting_count == posting_capacity) {
+        int capacity = posting_capacity ? posting_capacity * 2 : MIN_POSTINGS;
+        Posting *grown = realloc(postings, capacity * sizeof(Posting));
+        if (!grown) return -1;
+        postings = grown;
+        posting_capacity = capacity;
+    }
+    postings[posting_count] = (Posting){ .skill = skill, .tf = 0, .next = next };
+    return posting_count++;
+}
+
+// Skills are indexed one at a time, so the current skill's posting is
+// always at the head of each term's list.
+static void index_text(int skill, const char *text, int weight) {
+    char term[MAX_TERM];
+    for (const char *p = text; next_term(&p, term, sizeof(term));) {
+        Term *t = find_term(term, 1);
+        if (!t) continue;
+
+        if (t->first == -1 || postings[t->first].skill != skill) {
+            int posting = add_posting(skill, t->first);
+            if (posting == -1) continue;
+            t->first = posting;
+        }
+        postings[t->first].tf += weight;
+        skills[skill].length += weight;
+        indexed_terms += weight;
+    }
+}
+
+static int valid_tool_name(const char *name) {
+    for (const char *p = name; *p; p++) {
+        if (!((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') ||
+              *p == '_' || *p == '-')) return 0;
+    }
+    return *name != '\0';
+}
+
+// "script: name | description | param:type[!] ..." declares a script as a
+// tool. Types are JSON schema primitives; a trailing '!' marks a required
+// parameter. Parameters are passed to the script as --param value.
+static void append_script_tool(Skill *skill, char *decl) {
+    char *fields[3] = {0};
+    fields[0] = decl;
+    for (int i = 1; i < 3 && fields[i - 1]; i++) {
+        char *bar = strchr(fields[i - 1], '|');
+        if (bar) { *bar = '\0'; fields[i] = bar + 1; }
+    }
+
+    char *script = trim(fields[0]);
+    char tool_name[MAX_SKILL_NAME * 2 + 2];
+    snprintf(tool_name, sizeof(tool_name), "%s__%s", skill->name, script);
+    if (!validate_skill_name(script) || !valid_tool_name(tool_name) || strlen(tool_name) > 64) return;
+
+    char description[512];
+    json_escape(fields[1] ? trim(fields[1]) : script, description, sizeof(description));
+
+    char properties[MAX_SKILL_PATH] = "", required[MAX_SKILL_PATH] = "";
+    if (fields[2]) {
+        for (char *tok, *tmp = fields[2]; (tok = strtok(tmp, " \t,")); tmp = NULL) {
+            char *type = strchr(tok, ':');
+            if (!type) continue;
+            *type++ = '\0';
+
+            size_t len = strlen(type);
+            int is_required = len && type[len - 1] == '!';
+            if (is_required) type[len - 1] = '\0';
+            if (!valid_tool_name(tok) || !valid_tool_name(type)) continue;
+
+            snprintf(properties + strlen(properties), sizeof(properties) - strlen(properties),
+                     "%s\"%s\":{\"type\":\"%s\"}", *properties ? "," : "", tok, type);
+            if (is_required) {
+                snprintf(required + strlen(required), sizeof(required) - strlen(required),
+                         "%s\"%s\"", *required ? "," : "", tok);
+            }
+        }
+    }
+
+    char tool[MAX_SKILL_RESULT];
+    int n = snprintf(tool, sizeof(tool),
+                     "{\"type\":\"function\",\"function\":{\"name\":\"%s\",\"description\":\"%s\","
+                     "\"parameters\":{\"type\":\"object\",\"properties\":{%s},\"required\":[%s]}}}",
+                     tool_name, description, properties, required);
+
+    size_t used = strlen(skill->tools);
+    if (n <= 0 || used + n + 2 >= sizeof(skill->tools)) return;
+    snprintf(skill->tools + used, sizeof(skill->tools) - used, "%s%s", used ? "," : "", tool);
+}
+
+static void index_skill(const char *skill_name, const char *description) {
+    if (skill_total == skill_capacity) {
+        int capacity = skill_capacity ? skill_capacity * 2 : 64;
+        Skill *grown = realloc(skills, capacity * sizeof(Skill));
+        if (!grown) return;
+        skills = grown;
+        skill_capacity = capacity;
+    }
+
+    int idx = skill_total++;
+    Skill *skill = &skills[idx];
+    snprintf(skill->name, sizeof(skill->name), "%s", skill_name);
+    snprintf(skill->description, sizeof(skill->description), "%s", description);
+    skill->tools[0] = '\0';
+    skill->length = 0;
+
+    index_text(idx, skill_name, NAME_WEIGHT);
+    index_text(idx, description, 1);
+
+    char skill_path[MAX_SKILL_PATH];
+    build_skill_path(skill_name, NULL, skill_path, sizeof(skill_path));
+
+    char md_path[MAX_SKILL_PATH];
+    snprintf(md_path, sizeof(md_path), "%s/SKILL.md", skill_path);
+
+    FILE *file = fopen(md_path, "r");
+    if (!file) return;
+
+    char line[MAX_SKILL_PATH];
+    int fences = 0;
+    while (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\n")] = '\0';
+        if (fences < 2 && strcmp(trim(line), "---") == 0) { fences++; continue; }
+
+        index_text(idx, line, 1);
+        if (fences == 1 && strncmp(trim(line), "script:", 7) == 0) append_script_tool(skill, trim(line) + 7);
+    }
+
+    fclose(file);
+}
+
+const char *skill_tools(void) {
+    return tools_cache;
+}
+
+// With selected NULL, caches the first count skills.
+static void cache_tools(const int *selected, int count) {
+    tools_cache[0] = '\0';
+    for (int i = 0; i < count; i++) {
+        const Skill *skill = &skills[selected ? selected[i] : i];
+        size_t used = strlen(tools_cache), len = strlen(skill->tools);
+        if (!len || used + len + 2 >= sizeof(tools_cache)) continue;
+        snprintf(tools_cache + used, sizeof(tools_cache) - used, "%s%s", used ? "," : "", skill->tools);
+    }
+}
+
+// Picks the top_k skills most relevant to the task and makes only those
+// visible: skills_list gets their prompt entries and skill_tools() their
+// script tools. Returns -1 when every skill fits and nothing was ranked.
+int select_skills(const char *task, int top_k, char *skills_list, size_t list_size) {
+    if (skill_total <= top_k) return -1;
+
+    double *scores = calloc(skill_total, sizeof(double));
+    int *selected = malloc(top_k * sizeof(int)), count = 0;
+    if (!scores || !selected) {
+        free(scores);
+        free(selected);
+        return -1;
+    }
+    double avg_length = (double)indexed_terms / skill_total;
+
+    char term[MAX_TERM];
+    for (const char *p = task; next_term(&p, term, sizeof(term));) {
+        Term *t = find_term(term, 0);
+        if (!t) continue;
+
+        int df = 0;
+        for (int i = t->first; i != -1; i = postings[i].next) df++;
+        double idf = log(1.0 + (skill_total - df + 0.5) / (df + 0.5));
+
+        for (int i = t->first; i != -1; i = postings[i].next) {
+            const Posting *post = &postings[i];
+            double norm = 1.0 - BM25_B + BM25_B * skills[post->skill].length / avg_length;
+            scores[post->skill] += idf * post->tf * (BM25_K1 + 1.0) / (post->tf + BM25_K1 * norm);
+        }
+    }
+
+    while (count < top_k) {
+        int best = -1;
+        for (int i = 0; i < skill_total; i++) {
+            if (scores[i] > 0 && (best == -1 || scores[i] > scores[best])) best = i;
+        }
+        if (best == -1) break;
+        selected[count++] = best;
+        scores[best] = 0;
+    }
+
+    skills_list[0] = '\0';
+    for (int i = 0; i < count; i++) {
+        snprintf(skills_list + strlen(skills_list), list_size - strlen(skills_list),
+                 "- %s: %s\n", skills[selected[i]].name, skills[selected[i]].description);
+    }
+    snprintf(skills_list + strlen(skills_list), list_size - strlen(skills_list),
+             "(%d more skills not listed; call extract_skill by name if one is needed)\n", skill_total - count);
+
+    cache_tools(selected, count);
+    free(scores);
+    free(selected);
+    return count;
+}
+
+// Looks for a "<key>: true" line in the skill's SKILL.md front matter.
+static int skill_flag(const char *skill_name, const char *key) {
+    if (!validate_skill_name(skill_name)) return 0;
+
+    char skill_path[MAX_SKILL_PATH];
+    build_skill_path(skill_name, NULL, skill_path, sizeof(skill_path));
+
+    char md_path[MAX_SKILL_PATH];
+    snprintf(md_path, sizeof(md_path), "%s/SKILL.md", skill_path);
+
+    FILE *file = fopen(md_path, "r");
+    if (!file) return 0;
+
+    char line[256];
+    size_t key_len = strlen(key);
+    int set = 0, fences = 0;
+    while (fgets(line, sizeof(line), file) && fences < 2) {
+        char *text = trim(line);
+        if (strcmp(text, "---") == 0) { fences++; continue; }
+        if (fences == 1 && strncmp(text, key, key_len) == 0 && text[key_len] == ':') {
+            set = strcmp(trim(text + key_len + 1), "true") == 0;
+        }
+    }
+
+    fclose(file);
+    return set;
+}
+
+// Skills opt into speculative execution with "readonly: true" in SKILL.md.
+int skill_is_readonly(const char *skill_name) {
+    return skill_flag(skill_name, "readonly");
+}
+
+// Skills marked "persistent: true" run their .py/.js scripts in warm
+// interpreter workers instead of a fresh process per call.
+int skill_is_persistent(const char *skill_name) {
+    return skill_flag(skill_name, "persistent");
+}
+
+static void prestart_workers(const char *skill_name) {
+    char scripts_path[MAX_SKILL_PATH];
+    build_skill_path(skill_name, "", scripts_path, sizeof(scripts_path));
+
+    DIR *dir = opendir(scripts_path);
+    if (!dir) return;
+
+    struct dirent *entry;
+    int wanted_py = 0, wanted_js = 0;
+    while ((entry = readdir(dir)) != NULL) {
+        const char *ext = strrchr(entry->d_name, '.');
+        if (!ext) continue;
+        if (strcmp(ext, ".py") == 0) wanted_py = 1;
+        if (strcmp(ext, ".js") == 0) wanted_js = 1;
+    }
+    closedir(dir);
+
+    if (wanted_py) worker_prestart("py");
+    if (wanted_js) worker_prestart("js");
+}
+
 int discover_skills(char *skills_list, size_t list_size) {
     if (!skills_list || list_size == 0) return -1;
 
     skills_list[0] = '\0';
     int skill_count = 0;
+    skill_total = 0;
+    posting_count = 0;
+    indexed_terms = 0;
+    term_count = 0;
+    if (term_slots) memset(terms, 0, term_slots * sizeof(Term));
+    else grow_terms();
 
     char skills_dir[MAX_SKILL_PATH];
     snprintf(skills_dir, sizeof(skills_dir), "%s/.agent-c/skills", getenv("HOME"));
@@ -100,16 +448,19 @@ int discover_skills(char *skills_list, size_t list_size) {
 
         if (!is_directory(entry_path)) continue;
 
-        if (strlen(skills_list) >= list_size - 200) {
-            skill_count++;
-            continue;
-        }
-
         char description[MAX_CONTENT];
         if (extract_skill_description(entry->d_name, description, sizeof(description)) != 0) {
             snprintf(description, sizeof(description), "Skill: %s", entry->d_name);
         }
 
+        index_skill(entry->d_name, description);
+        if (skill_is_persistent(entry->d_name)) prestart_workers(entry->d_name);
+
+        if (strlen(skills_list) >= list_size - 200) {
+            skill_count++;
+            continue;
+        }
+
         char skill_entry[MAX_SKILL_PATH];
         snprintf(skill_entry, sizeof(skill_entry), "- %s: %s\n", entry->d_name, description);
 
@@ -120,6 +471,9 @@ int discover_skills(char *skills_list, size_t list_size) {
     }
 
     closedir(dir);
+
+    cache_tools(NULL, skill_total);
+
     return skill_count;
 }
 
@@ -187,10 +541,14 @@ static int parse_command(const char *skill_command, char *skill_name, char *scri
     return 0;
 }
 
-int execute_skill(const char *skill_command, char *result, size_t result_size) {
+int execute_skill(const char *skill_command, char *result, size_t result_size, ToolUsage *usage) {
     if (!skill_command || !result || result_size == 0) return -1;
 
     result[0] = '\0';
+    ToolUsage unused;
+    if (!usage) usage = &unused;
+    memset(usage, 0, sizeof(*usage));
+    usage->maxrss_kb = -1;
 
     char skill_name[MAX_SKILL_NAME] = {0};
     char script_name[MAX_SKILL_NAME] = {0};
@@ -203,6 +561,11 @@ int execute_skill(const char *skill_command, char *result, size_t result_size) {
 
     if (find_script_path(skill_name, script_name, script_path, sizeof(script_path)) != 0) return -3;
 
+    int status;
+    if (skill_is_persistent(skill_name) && worker_exec(script_path, args, result, result_size, &status, usage) == 0) {
+        return status == 0 ? 0 : -1;
+    }
+
     char temp_path[64];
     snprintf(temp_path, sizeof(temp_path), "/tmp/ai_skill_XXXXXX");
 
@@ -217,7 +580,7 @@ int execute_skill(const char *skill_command, char *result, size_t result_size) {
         snprintf(exec_cmd, sizeof(exec_cmd), "\"%s\" > \"%s\" 2>&1", script_path, temp_path);
     }
 
-    int exit_code = system(exec_cmd);
+    int exit_code = usage_run(exec_cmd, usage, cmd_timeout_ms());
 
     FILE *temp_file = fopen(temp_path, "r");
     int read_result = -1;
@@ -0,0 +1,127 @@
+#include "agent-c.h"
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+
+// Speculative tool execution: side-effect-free tool calls are started in a
+// child process while the completion is still streaming. The result is only
+// used if the final response asks for exactly the same call. The output file
+// starts with the run's wall time; CPU, RSS and I/O come from wait4().
+
+typedef struct {
+    pid_t pid;
+    char tool[MAX_SKILL_NAME];
+    char arg[MAX_CONTENT];
+    char output[64];
+} Speculation;
+
+static Speculation specs[MAX_SPECULATIONS];
+
+// Each child leads its own process group. SIGINT takes it through the same
+// cancel path as Ctrl-C: usage_run stops the command's group and the temp
+// output is removed. Only a child still running after that gets SIGKILL.
+static void release(Speculation *s, int stop_child) {
+    if (!s->pid) return;
+    if (stop_child) {
+        kill(-s->pid, SIGINT);
+        if (loop_wait_pid(s->pid, LOOP_GRACE_MS * 2, 0) != 1) kill(-s->pid, SIGKILL);
+    }
+    waitpid(s->pid, NULL, 0);
+    unlink(s->output);
+    s->pid = 0;
+}
+
+int spec_start(const char *tool, const char *arg, SpecRunFn run) {
+    Speculation *s = NULL;
+    for (int i = 0; i < MAX_SPECULATIONS; i++) {
+        if (specs[i].pid && strcmp(specs[i].tool, tool) == 0 && strcmp(specs[i].arg, arg) == 0) return 0;
+        if (!specs[i].pid && !s) s = &specs[i];
+    }
+    if (!s) return -1;
+
+    snprintf(s->output, sizeof(s->output), "/tmp/ai_spec_XXXXXX");
+    int fd = mkstemp(s->output);
+    if (fd == -1) return -1;
+
+    // SIGINT stays blocked until the child has its own handler, so a
+    // release() right after the fork is not lost.
+    sigset_t block, saved;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigprocmask(SIG_BLOCK, &block, &saved);
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == -1) {
+        sigprocmask(SIG_SETMASK, &saved, NULL);
+        close(fd);
+        unlink(s->output);
+        return -1;
+    }
+
+    if (pid == 0) {
+        setpgid(0, 0);
+        loop_init();
+        sigprocmask(SIG_SETMASK, &saved, NULL);
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        char result[MAX_CONTENT] = {0};
+        int code = run(arg, result, sizeof(result));
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double wall_s = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        write(fd, &wall_s, sizeof(wall_s));
+        write(fd, result, strlen(result));
+        _exit(code & 0xff);
+    }
+
+    sigprocmask(SIG_SETMASK, &saved, NULL);
+    setpgid(pid, pid);
+    close(fd);
+    s->pid = pid;
+    snprintf(s->tool, sizeof(s->tool), "%s", tool);
+    snprintf(s->arg, sizeof(s->arg), "%s", arg);
+    return 0;
+}
+
+// Returns the speculative run's exit code, or -1 if nothing matched.
+int spec_claim(const char *tool, const char *arg, char *result, size_t result_size, ToolUsage *usage) {
+    for (int i = 0; i < MAX_SPECULATIONS; i++) {
+        Speculation *s = &specs[i];
+        if (!s->pid || strcmp(s->tool, tool) != 0 || strcmp(s->arg, arg) != 0) continue;
+
+        if (loop_wait_pid(s->pid, -1, 1) == LOOP_CANCELLED) {
+            release(s, 1);
+            return -1;
+        }
+
+        int status;
+        if (usage_wait(s->pid, &status, usage) == -1 || !WIFEXITED(status)) {
+            unlink(s->output);
+            s->pid = 0;
+            return -1;
+        }
+        s->pid = 0;
+
+        FILE *f = fopen(s->output, "r");
+        usage->wall_s = 0;
+        if (f && fread(&usage->wall_s, sizeof(usage->wall_s), 1, f) != 1) usage->wall_s = 0;
+        size_t bytes = f ? fread(result, 1, result_size - 1, f) : 0;
+        result[bytes] = '\0';
+        if (f) fclose(f);
+        unlink(s->output);
+
+        usage->status = WEXITSTATUS(status);
+        return WEXITSTATUS(status);
+    }
+    return -1;
+}
+
+// Every child is interrupted before any is waited for, so they wind down
+// together.
+void spec_reset(void) {
+    for (int i = 0; i < MAX_SPECULATIONS; i++) {
+        if (specs[i].pid) kill(-specs[i].pid, SIGINT);
+    }
+    for (int i = 0; i < MAX_SPECULATIONS; i++) release(&specs[i], 1);
+}
@@ -0,0 +1,230 @@
+// wait4() and struct rusage's full field set are outside strict POSIX.
+#define _DEFAULT_SOURCE
+#define _DARWIN_C_SOURCE
+
+#include "agent-c.h"
+#include <errno.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+extern Config config;
+
+// Per-tool resource accounting. Cold processes are measured exactly with
+// wait4(); long-lived processes (the session shell, interpreter workers) are
+// measured as the difference of their /proc counters around the call, which
+// includes every child they reaped in between. Results are aggregated per
+// session by tool kind and skill or program name.
+
+#define MAX_USAGE_KEYS 64
+
+typedef struct {
+    char kind[8];
+    char name[MAX_SKILL_NAME * 2];
+    int calls;
+    int failures;
+    ToolUsage total;
+} UsageEntry;
+
+static UsageEntry entries[MAX_USAGE_KEYS];
+static int entry_count;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void from_rusage(const struct rusage *ru, ToolUsage *u) {
+    u->user_s = ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6;
+    u->sys_s = ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+#ifdef __APPLE__
+    u->maxrss_kb = ru->ru_maxrss / 1024;
+#else
+    u->maxrss_kb = ru->ru_maxrss;
+#endif
+    u->in_blocks = ru->ru_inblock;
+    u->out_blocks = ru->ru_oublock;
+}
+
+pid_t usage_wait(pid_t pid, int *status, ToolUsage *u) {
+    struct rusage ru;
+    pid_t rc;
+    while ((rc = wait4(pid, status, 0, &ru)) == -1 && errno == EINTR) {}
+    if (rc == pid && u) from_rusage(&ru, u);
+    return rc;
+}
+
+// Runs cmd through /bin/sh like system(), returning the raw wait status.
+// Ctrl-C stops the command's process group and reports it as killed by
+// SIGINT. A command still running after timeout_ms (-1 for none) is stopped
+// the same way and USAGE_TIMED_OUT returned.
+int usage_run(const char *cmd, ToolUsage *u, int timeout_ms) {
+    double start = now_s();
+
+    pid_t pid = loop_spawn(cmd, NULL);
+    if (pid == -1) return -1;
+    int waited = loop_wait_pid(pid, timeout_ms, 1);
+    if (waited == LOOP_CANCELLED || waited == 0) loop_stop_group(pid);
+
+    int status = -1;
+    ToolUsage measured = {0};
+    if (usage_wait(pid, &status, &measured) != pid) status = -1;
+
+    if (u) {
+        *u = measured;
+        u->wall_s = now_s() - start;
+        u->status = status == -1 ? -1 : WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    }
+    return waited == 0 ? USAGE_TIMED_OUT : status;
+}
+
+// Cumulative counters of a live process from /proc; -1 where unavailable.
+static int proc_sample(pid_t pid, ToolUsage *u) {
+    char path[64], line[512];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    char *fields = fgets(line, sizeof(line), f) ? strrchr(line, ')') : NULL;
+    fclose(f);
+
+    // After "pid (comm)": state is field 3, utime/stime/cutime/cstime 14-17.
+    unsigned long utime, stime;
+    long cutime, cstime;
+    if (!fields || sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %ld %ld",
+                          &utime, &stime, &cutime, &cstime) != 4) return -1;
+
+    double tick = (double)sysconf(_SC_CLK_TCK);
+    u->user_s = (utime + cutime) / tick;
+    u->sys_s = (stime + cstime) / tick;
+
+    // Storage-level bytes, reported in the same 512-byte units as rusage.
+    u->in_blocks = u->out_blocks = 0;
+    snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+    if ((f = fopen(path, "r"))) {
+        long long bytes;
+        while (fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "read_bytes: %lld", &bytes) == 1) u->in_blocks = bytes / 512;
+            if (sscanf(line, "write_bytes: %lld", &bytes) == 1) u->out_blocks = bytes / 512;
+        }
+        fclose(f);
+    }
+
+    u->maxrss_kb = -1;
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    if ((f = fopen(path, "r"))) {
+        while (fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "VmHWM: %ld", &u->maxrss_kb) == 1) break;
+        }
+        fclose(f);
+    }
+    return 0;
+}
+
+void usage_begin(pid_t pid, ToolUsage *u) {
+    memset(u, 0, sizeof(*u));
+    u->maxrss_kb = -1;
+    u->wall_s = now_s();
+    if (proc_sample(pid, u) != 0) u->maxrss_kb = -2;
+}
+
+// Turns the snapshot taken by usage_begin into deltas. A process that died
+// in between, or a system without /proc, leaves only wall time.
+void usage_end(pid_t pid, ToolUsage *u) {
+    ToolUsage end;
+    int sampled = u->maxrss_kb != -2 && proc_sample(pid, &end) == 0;
+
+    u->wall_s = now_s() - u->wall_s;
+    if (sampled) {
+        u->user_s = end.user_s - u->user_s;
+        u->sys_s = end.sys_s - u->sys_s;
+        u->in_blocks = end.in_blocks - u->in_blocks;
+        u->out_blocks = end.out_blocks - u->out_blocks;
+        u->maxrss_kb = end.maxrss_kb;
+    } else {
+        u->user_s = u->sys_s = 0;
+        u->in_blocks = u->out_blocks = 0;
+        u->maxrss_kb = -1;
+    }
+}
+
+static void format_rss(long kb, char *out, size_t size) {
+    if (kb < 0) snprintf(out, size, "-");
+    else if (kb >= 1024 * 1024) snprintf(out, size, "%.1fG", kb / 1048576.0);
+    else if (kb >= 1024) snprintf(out, size, "%.1fM", kb / 1024.0);
+    else snprintf(out, size, "%ldK", kb);
+}
+
+static UsageEntry *find_entry(const char *kind, const char *name) {
+    for (int i = 0; i < entry_count; i++) {
+        if (strcmp(entries[i].kind, kind) == 0 && strcmp(entries[i].name, name) == 0) return &entries[i];
+    }
+    if (entry_count == MAX_USAGE_KEYS) {
+        // Table full: fold the rest into the last slot.
+        UsageEntry *e = &entries[MAX_USAGE_KEYS - 1];
+        snprintf(e->kind, sizeof(e->kind), "other");
+        snprintf(e->name, sizeof(e->name), "(other)");
+        return e;
+    }
+    UsageEntry *e = &entries[entry_count++];
+    e->total.maxrss_kb = -1;
+    snprintf(e->kind, sizeof(e->kind), "%s", kind);
+    snprintf(e->name, sizeof(e->name), "%s", name);
+    return e;
+}
+
+// Records one tool run under kind/name and prints it when AGENTC_USAGE is set.
+void usage_record(const char *kind, const char *name, const ToolUsage *u) {
+    UsageEntry *e = find_entry(kind, name);
+    e->calls++;
+    if (u->status != 0) e->failures++;
+    e->total.wall_s += u->wall_s;
+    e->total.user_s += u->user_s;
+    e->total.sys_s += u->sys_s;
+    e->total.in_blocks += u->in_blocks;
+    e->total.out_blocks += u->out_blocks;
+    if (u->maxrss_kb > e->total.maxrss_kb) e->total.maxrss_kb = u->maxrss_kb;
+
+    if (!config.show_usage) return;
+
+    char rss[16];
+    format_rss(u->maxrss_kb, rss, sizeof(rss));
+    printf("\033[2m⏱  %.2fs wall, %.2fs user, %.2fs sys, %s rss, %ld/%ld blk in/out, exit %d\033[0m\n",
+           u->wall_s, u->user_s, u->sys_s, rss, u->in_blocks, u->out_blocks, u->status);
+}
+
+void usage_summary(void) {
+    if (!entry_count) {
+        printf("No tool runs recorded this session\n");
+        return;
+    }
+
+    // Heaviest first by CPU time, then wall time.
+    UsageEntry sorted[MAX_USAGE_KEYS];
+    memcpy(sorted, entries, sizeof(UsageEntry) * entry_count);
+    for (int i = 1; i < entry_count; i++) {
+        UsageEntry cur = sorted[i];
+        double key = cur.total.user_s + cur.total.sys_s;
+        int j = i - 1;
+        while (j >= 0 && (sorted[j].total.user_s + sorted[j].total.sys_s < key ||
+                          (sorted[j].total.user_s + sorted[j].total.sys_s == key &&
+                           sorted[j].total.wall_s < cur.total.wall_s))) {
+            sorted[j + 1] = sorted[j];
+            j--;
+        }
+        sorted[j + 1] = cur;
+    }
+
+    printf("\033[36m📊 Tool usage this session\033[0m\n");
+    printf("%-6s %-24s %5s %5s %9s %9s %9s %8s %8s %8s\n",
+           "kind", "name", "calls", "fail", "wall s", "user s", "sys s", "max rss", "blk in", "blk out");
+    for (int i = 0; i < entry_count; i++) {
+        const UsageEntry *e = &sorted[i];
+        char rss[16];
+        format_rss(e->total.maxrss_kb, rss, sizeof(rss));
+        printf("%-6s %-24.24s %5d %5d %9.2f %9.2f %9.2f %8s %8ld %8ld\n",
+               e->kind, e->name, e->calls, e->failures, e->total.wall_s, e->total.user_s,
+               e->total.sys_s, rss, e->total.in_blocks, e->total.out_blocks);
+    }
+}
@@ -1,4 +1,6 @@
 #include "agent-c.h"
+#include <ctype.h>
+#include <errno.h>
 
 extern Config config;
 
@@ -7,6 +9,11 @@ static void load_env(char *dest, const char *env_var, size_t size) {
     if (value) snprintf(dest, size, "%s", value);
 }
 
+static void load_env_int(int *dest, const char *env_var, int min) {
+    const char *value = getenv(env_var);
+    if (value && atoi(value) >= min) *dest = atoi(value);
+}
+
 static void format_providers(const char *providers, char *out, size_t size) {
     if (!providers || !out) return;
 
@@ -19,28 +26,60 @@ static void format_providers(const char *providers, char *out, size_t size) {
     }
 }
 
-int http_request(const char *req, char *resp, size_t resp_size) {
-    char temp[] = "/tmp/ai_req_XXXXXX";
-    int fd = mkstemp(temp);
-    if (fd == -1) return -1;
-    write(fd, req, strlen(req));
-    close(fd);
-
-    char curl[MAX_BUFFER];
-    snprintf(curl, sizeof(curl),
-             "curl -s -X POST '%s' -H 'Content-Type: application/json' -H 'Authorization: Bearer %s' -d @'%s' --max-time 60",
-             config.base_url, config.api_key, temp);
-
-    FILE *pipe = popen(curl, "r");
-    if (!pipe) { unlink(temp); return -1; }
-
-    size_t bytes = fread(resp, 1, resp_size - 1, pipe);
-    resp[bytes] = '\0';
-    pclose(pipe);
-    unlink(temp);
+static int is_stopword(const char *term) {
+    static const char *stopwords[] = {
+        "the", "and", "for", "with", "that", "this", "from", "are", "was", "you", "your",
+        "can", "use", "how", "what", "into", "not", "all", "any", "our", "its", "it", "to",
+        "of", "in", "on", "is", "be", "as", "an", "or", "at", "by", "me", "my", "do", NULL
+    };
+    for (int i = 0; stopwords[i]; i++) {
+        if (strcmp(term, stopwords[i]) == 0) return 1;
+    }
     return 0;
 }
 
+// Splits text into lowercase alphanumeric terms for the local search
+// indexes. Stopwords and one-letter terms are skipped and a plural 's' is
+// stripped so "commits" matches "commit".
+int next_term(const char **cursor, char *term, size_t size) {
+    const char *p = *cursor;
+    for (;;) {
+        while (*p && !isalnum((unsigned char)*p)) p++;
+        if (!*p) {
+            *cursor = p;
+            return 0;
+        }
+
+        size_t len = 0;
+        for (; isalnum((unsigned char)*p); p++) {
+            if (len < size - 1) term[len++] = tolower((unsigned char)*p);
+        }
+        term[len] = '\0';
+
+        if (len < 2 || is_stopword(term)) continue;
+        if (len > 3 && term[len - 1] == 's' && term[len - 2] != 's') term[len - 1] = '\0';
+
+        *cursor = p;
+        return 1;
+    }
+}
+
+// Pipe writes to a coprocess that exited on its own must not take the agent
+// down with SIGPIPE.
+int write_all(int fd, const char *buf, size_t len) {
+    void (*old)(int) = signal(SIGPIPE, SIG_IGN);
+    int rc = 0;
+    while (len) {
+        ssize_t n = write(fd, buf, len);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) { rc = -1; break; }
+        buf += n;
+        len -= n;
+    }
+    signal(SIGPIPE, old);
+    return rc;
+}
+
 void load_config(void) {
     strcpy(config.model, "qwen/qwen3-coder");
     config.temp = 0.1;
@@ -49,10 +88,50 @@ void load_config(void) {
     strcpy(config.base_url, "https://openrouter.ai/api/v1/chat/completions");
     strcpy(config.op_providers, "cerebras");
     config.op_providers_on = 1;
+    config.max_retries = 3;
+    config.max_inflight = 4;
+    config.speculate = 0;
+    config.skill_top_k = 5;
+    config.persistent_shell = 1;
+    config.cmd_timeout = 600;
+    config.workers = 2;
+    config.worker_idle = 300;
+    config.show_usage = 0;
+    config.dedup = 1;
+    config.fast_model[0] = config.strong_model[0] = '\0';
+    config.route_big_prompt = 24000;
+    config.archive = 1;
+    config.recall = 0;
+    config.compress[0] = '\0';
+    config.accept_encoding = 0;
+    strcpy(config.safe_commands, "ls,cat,head,tail,wc,pwd,grep,git status,git diff,git log,git show");
 
     load_env(config.api_key, "AGENTC_API_KEY", sizeof(config.api_key));
     load_env(config.base_url, "AGENTC_BASE_URL", sizeof(config.base_url));
     load_env(config.model, "AGENTC_MODEL", sizeof(config.model));
+    load_env_int(&config.max_retries, "AGENTC_MAX_RETRIES", 0);
+    load_env_int(&config.max_inflight, "AGENTC_MAX_INFLIGHT", 1);
+    load_env_int(&config.speculate, "AGENTC_SPECULATE", 0);
+    load_env(config.safe_commands, "AGENTC_SAFE_COMMANDS", sizeof(config.safe_commands));
+    load_env_int(&config.skill_top_k, "AGENTC_SKILL_TOPK", 1);
+    load_env_int(&config.persistent_shell, "AGENTC_PERSISTENT_SHELL", 0);
+    load_env_int(&config.cmd_timeout, "AGENTC_CMD_TIMEOUT", 0);
+    load_env_int(&config.workers, "AGENTC_WORKERS", 0);
+    load_env_int(&config.worker_idle, "AGENTC_WORKER_IDLE", 1);
+    load_env_int(&config.show_usage, "AGENTC_USAGE", 0);
+    load_env_int(&config.dedup, "AGENTC_DEDUP", 0);
+    load_env(config.fast_model, "AGENTC_FAST_MODEL", sizeof(config.fast_model));
+    load_env(config.strong_model, "AGENTC_STRONG_MODEL", sizeof(config.strong_model));
+    load_env_int(&config.route_big_prompt, "AGENTC_ROUTE_BIG_PROMPT", 1);
+    load_env_int(&config.archive, "AGENTC_ARCHIVE", 0);
+    load_env_int(&config.recall, "AGENTC_RECALL", 0);
+    if (!config.fast_model[0]) strcpy(config.fast_model, config.model);
+    if (!config.strong_model[0]) strcpy(config.strong_model, config.model);
+    if (config.workers > MAX_WORKERS) config.workers = MAX_WORKERS;
+    load_env(config.compress, "AGENTC_COMPRESS", sizeof(config.compress));
+    load_env_int(&config.accept_encoding, "AGENTC_ACCEPT_ENCODING", 0);
+    if (strcmp(config.compress, "none") == 0) config.compress[0] = '\0';
+    if (config.compress[0]) config.accept_encoding = 1;
 
     const char *op_provider = getenv("AGENTC_OP_PROVIDER");
     if (op_provider) {
@@ -73,3 +152,8 @@ void load_config(void) {
         config.op_providers_json[0] = '\0';
     }
 }
+
+// AGENTC_CMD_TIMEOUT=0 turns the limit off; loop waits take -1 for that.
+int cmd_timeout_ms(void) {
+    return config.cmd_timeout > 0 ? config.cmd_timeout * 1000 : -1;
+}
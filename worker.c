@@ -0,0 +1,309 @@
+#include "agent-c.h"
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/wait.h>
+
+extern Config config;
+
+// Warm interpreters for skills that declare "persistent: true". Each worker
+// is a python3 or node process running a small shim that executes one
+// script per request in-process, so interpreter start-up and module imports
+// are paid once per worker instead of once per call. Tool calls run one at
+// a time, so each language has at most one worker; config.workers caps how
+// many languages stay warm at once, evicting the least recently used.
+//
+// The protocol runs on fds 3 (requests) and 4 (replies), so nothing a
+// script or its subprocesses write can corrupt the framing:
+//
+// Request:  "<script_len> <args_len> <cwd_len>\n" script args cwd
+// Response: "<exit_code> <output_len>\n" output
+//
+// fds 1 and 2 share an unlinked append-only temp file. The shim empties it
+// before each call and sends back what the call left in it, so output from
+// print(), console.log(), os.system() and child processes is all captured.
+
+#define WORKER_MAX_USES 200
+#define READ_TIMEOUT -3
+#define REQUEST_FD 3
+#define REPLY_FD 4
+
+typedef struct {
+    pid_t pid;
+    int in, out;
+    char lang[4];
+    time_t last_used;
+    int uses;
+} Worker;
+
+static Worker workers[MAX_WORKERS];
+static pid_t pool_owner;
+
+static const char *python_shim =
+    "import sys, io, os, runpy, shlex, traceback\n"
+    "inp, out = os.fdopen(3, 'rb'), os.fdopen(4, 'wb')\n"
+    "os.set_inheritable(3, False); os.set_inheritable(4, False)\n"
+    "while True:\n"
+    "    hdr = inp.readline()\n"
+    "    if not hdr: break\n"
+    "    sizes = [int(n) for n in hdr.split()]\n"
+    "    script, args, cwd = (inp.read(n).decode() for n in sizes)\n"
+    "    code = 0\n"
+    "    os.ftruncate(1, 0)\n"
+    "    saved, path = (sys.stdin, sys.stdout, sys.stderr, sys.argv), sys.path[:]\n"
+    "    sys.stdin = io.StringIO()\n"
+    "    try:\n"
+    "        os.chdir(cwd)\n"
+    "        sys.argv = [script] + shlex.split(args)\n"
+    "        sys.path.insert(0, os.path.dirname(os.path.abspath(script)))\n"
+    "        runpy.run_path(script, run_name='__main__')\n"
+    "    except SystemExit as e:\n"
+    "        code = e.code if isinstance(e.code, int) else (0 if e.code is None else 1)\n"
+    "        if not isinstance(e.code, (int, type(None))): print(e.code)\n"
+    "    except BaseException:\n"
+    "        traceback.print_exc()\n"
+    "        code = 1\n"
+    "    finally:\n"
+    "        sys.stdin, sys.stdout, sys.stderr, sys.argv = saved\n"
+    "        sys.path[:] = path\n"
+    "        sys.stdout.flush(); sys.stderr.flush()\n"
+    "    data = os.pread(1, os.fstat(1).st_size, 0)\n"
+    "    os.ftruncate(1, 0)\n"
+    "    out.write(b'%d %d\\n' % (code, len(data)))\n"
+    "    out.write(data)\n"
+    "    out.flush()\n";
+
+// Node scripts run through require() with their cache entry dropped; a
+// script that exports a promise is awaited before the reply is sent.
+static const char *node_shim =
+    "const fs = require('fs');\n"
+    "let pending = Buffer.alloc(0), busy = false;\n"
+    "const split = s => { const r = []; let cur = '', q = null, has = false;\n"
+    "  for (let i = 0; i < s.length; i++) { const c = s[i];\n"
+    "    if (q) { if (c === q) q = null; else if (c === '\\\\' && q === '\"' && i + 1 < s.length) cur += s[++i]; else cur += c; }\n"
+    "    else if (c === '\\'' || c === '\"') { q = c; has = true; }\n"
+    "    else if (c === '\\\\' && i + 1 < s.length) { cur += s[++i]; has = true; }\n"
+    "    else if (/\\s/.test(c)) { if (has) r.push(cur); cur = ''; has = false; }\n"
+    "    else { cur += c; has = true; } }\n"
+    "  if (has) r.push(cur); return r; };\n"
+    "// Like a cold run, wait until the script's own timers, sockets and children are done.\n"
+    "let current = null;\n"
+    "const fail = e => { if (!current) throw e;\n"
+    "  if (e && e.agentcExit !== undefined) current.code = e.agentcExit;\n"
+    "  else { fs.writeSync(2, String(e && e.stack || e) + '\\n'); current.code = 1; }\n"
+    "  current.exited = true; };\n"
+    "process.on('uncaughtException', fail); process.on('unhandledRejection', fail);\n"
+    "const idle = base => new Promise(done => { const check = () =>\n"
+    "  !current.exited && process.getActiveResourcesInfo().length - 1 > base ? setTimeout(check, 5) : done();\n"
+    "  setTimeout(check, 0); });\n"
+    "async function run(script, args, cwd) {\n"
+    "  const exit = process.exit, argv = process.argv;\n"
+    "  current = { code: 0, exited: false };\n"
+    "  fs.ftruncateSync(1, 0);\n"
+    "  process.exit = c => { throw { agentcExit: c || 0 }; };\n"
+    "  try { process.chdir(cwd); process.argv = [argv[0], script, ...split(args)];\n"
+    "    delete require.cache[require.resolve(script)];\n"
+    "    const base = process.getActiveResourcesInfo().length;\n"
+    "    const m = require(script); if (m && typeof m.then === 'function') await m;\n"
+    "    await idle(base); }\n"
+    "  catch (e) { fail(e); }\n"
+    "  finally { process.exit = exit; process.argv = argv; }\n"
+    "  const code = current.code; current = null;\n"
+    "  const data = Buffer.alloc(fs.fstatSync(1).size);\n"
+    "  if (data.length) fs.readSync(1, data, 0, data.length, 0);\n"
+    "  fs.ftruncateSync(1, 0);\n"
+    "  fs.writeSync(4, code + ' ' + data.length + '\\n'); fs.writeSync(4, data); }\n"
+    "async function drain() { if (busy) return; busy = true;\n"
+    "  for (;;) { const nl = pending.indexOf(10); if (nl < 0) break;\n"
+    "    const sizes = pending.slice(0, nl).toString().split(' ').map(Number);\n"
+    "    if (pending.length < nl + 1 + sizes[0] + sizes[1] + sizes[2]) break;\n"
+    "    let o = nl + 1; const f = sizes.map(n => pending.slice(o, o += n).toString());\n"
+    "    pending = pending.slice(o); await run(f[0], f[1], f[2]); }\n"
+    "  busy = false; }\n"
+    "// A pipe socket keeps one steady handle, unlike a file stream's changing read requests.\n"
+    "new (require('net').Socket)({ fd: 3, readable: true }).on('data', d => { pending = Buffer.concat([pending, d]); drain(); });\n";
+
+static void worker_stop(Worker *w) {
+    if (!w->pid) return;
+    kill(-w->pid, SIGKILL);
+    waitpid(w->pid, NULL, 0);
+    close(w->in);
+    close(w->out);
+    w->pid = 0;
+}
+
+static int worker_start(Worker *w, const char *lang) {
+    int in, out;
+    pid_t pid = loop_fork_piped(&in, &out);
+    if (pid == -1) return -1;
+
+    if (pid == 0) {
+        // Lift the pipe ends clear of 0-4 before putting them in place.
+        int req = fcntl(in, F_DUPFD, 10), reply = fcntl(out, F_DUPFD, 10);
+        char capture[] = "/tmp/ai_worker_XXXXXX";
+        int cap = mkstemp(capture);
+        int null = open("/dev/null", O_RDONLY);
+        if (req == -1 || reply == -1 || cap == -1 || null == -1) _exit(127);
+        unlink(capture);
+        fcntl(cap, F_SETFL, O_APPEND);
+        dup2(null, STDIN_FILENO);
+        dup2(cap, STDOUT_FILENO);
+        dup2(cap, STDERR_FILENO);
+        dup2(req, REQUEST_FD);
+        dup2(reply, REPLY_FD);
+        int spare[] = {in, out, req, reply, cap, null};
+        for (int i = 0; i < 6; i++) {
+            if (spare[i] > REPLY_FD) close(spare[i]);
+        }
+        if (strcmp(lang, "py") == 0) {
+            execlp("python3", "python3", "-u", "-c", python_shim, (char *)NULL);
+        } else {
+            execlp("node", "node", "-e", node_shim, (char *)NULL);
+        }
+        _exit(127);
+    }
+
+    *w = (Worker){ .pid = pid, .in = in, .out = out, .last_used = time(NULL) };
+    snprintf(w->lang, sizeof(w->lang), "%s", lang);
+    return 0;
+}
+
+// Idle workers are recycled after config.worker_idle seconds and every
+// worker after WORKER_MAX_USES requests, bounding leaks from scripts that
+// mutate interpreter state.
+void worker_reap_idle(void) {
+    time_t now = time(NULL);
+    for (int i = 0; i < MAX_WORKERS; i++) {
+        Worker *w = &workers[i];
+        if (w->pid && (now - w->last_used > config.worker_idle || w->uses >= WORKER_MAX_USES)) worker_stop(w);
+    }
+}
+
+static Worker *worker_get(const char *lang) {
+    // Forked speculative runs share the parent's pipes; they start cold.
+    if (pool_owner && pool_owner != getpid()) return NULL;
+    pool_owner = getpid();
+    worker_reap_idle();
+
+    Worker *idle = NULL, *oldest = NULL;
+    int live = 0;
+    for (int i = 0; i < MAX_WORKERS; i++) {
+        Worker *w = &workers[i];
+        if (!w->pid) { if (!idle) idle = w; continue; }
+        live++;
+        if (strcmp(w->lang, lang) == 0) return w;
+        if (!oldest || w->last_used < oldest->last_used) oldest = w;
+    }
+
+    if (live >= config.workers || !idle) {
+        if (!oldest) return NULL;
+        worker_stop(oldest);
+        idle = oldest;
+    }
+    return worker_start(idle, lang) == 0 ? idle : NULL;
+}
+
+// Prestarting fills free slots only; it never evicts a live worker.
+void worker_prestart(const char *lang) {
+    int live = 0;
+    for (int i = 0; i < MAX_WORKERS; i++) {
+        if (!workers[i].pid) continue;
+        if (strcmp(workers[i].lang, lang) == 0) return;
+        live++;
+    }
+    if (live < config.workers) worker_get(lang);
+}
+
+// Returns 0 once len bytes are in, -1 if the worker died, READ_TIMEOUT or
+// LOOP_CANCELLED.
+static int read_full(int fd, char *buf, size_t len, long timeout_ms) {
+    size_t got = 0;
+    while (got < len) {
+        int ready = loop_wait(fd, (int)timeout_ms, 1);
+        if (ready != 1) return ready == 0 ? READ_TIMEOUT : ready;
+
+        ssize_t n = read(fd, buf + got, len - got);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        got += n;
+    }
+    return 0;
+}
+
+// Runs a .py or .js script in a warm worker. Returns -1 when no worker could
+// take the request (the caller then starts the script cold), otherwise 0
+// with *status set to the script's exit code.
+int worker_exec(const char *script_path, const char *args, char *result, size_t result_size, int *status,
+                ToolUsage *usage) {
+    const char *ext = strrchr(script_path, '.');
+    if (!ext || (strcmp(ext, ".py") != 0 && strcmp(ext, ".js") != 0)) return -1;
+
+    Worker *w = worker_get(ext + 1);
+    if (!w) return -1;
+    usage_begin(w->pid, usage);
+
+    char cwd[MAX_SKILL_PATH];
+    if (!getcwd(cwd, sizeof(cwd))) snprintf(cwd, sizeof(cwd), "/");
+
+    char header[96];
+    int header_len = snprintf(header, sizeof(header), "%zu %zu %zu\n", strlen(script_path), strlen(args), strlen(cwd));
+    if (write_all(w->in, header, header_len) || write_all(w->in, script_path, strlen(script_path)) ||
+        write_all(w->in, args, strlen(args)) || write_all(w->in, cwd, strlen(cwd))) {
+        usage_end(w->pid, usage);
+        worker_stop(w);
+        return -1;
+    }
+
+    w->uses++;
+    w->last_used = time(NULL);
+    result[0] = '\0';
+
+    // Reply header: read byte by byte up to the newline.
+    char reply[64];
+    size_t reply_len = 0;
+    int rc = 0;
+    while (reply_len < sizeof(reply) - 1) {
+        rc = read_full(w->out, reply + reply_len, 1, cmd_timeout_ms());
+        if (rc != 0 || reply[reply_len] == '\n') break;
+        reply_len++;
+    }
+    reply[reply_len] = '\0';
+
+    long output_len = 0;
+    if (rc == 0 && sscanf(reply, "%d %ld", status, &output_len) == 2) {
+        size_t keep = (size_t)output_len < result_size - 1 ? (size_t)output_len : result_size - 1;
+        rc = read_full(w->out, result, keep, cmd_timeout_ms());
+        result[rc == 0 ? keep : 0] = '\0';
+
+        char drain[1024];
+        for (long left = output_len - (long)keep; rc == 0 && left > 0; left -= sizeof(drain)) {
+            rc = read_full(w->out, drain, left < (long)sizeof(drain) ? (size_t)left : sizeof(drain),
+                           cmd_timeout_ms());
+        }
+        usage_end(w->pid, usage);
+        usage->status = *status;
+        if (rc == 0) return 0;
+    } else {
+        usage_end(w->pid, usage);
+    }
+
+    // A cancelled script may have left the interpreter in any state; the
+    // worker is simply replaced on the next call.
+    worker_stop(w);
+    if (rc == LOOP_CANCELLED) {
+        snprintf(result, result_size, "[skill cancelled by user]");
+        *status = 130;
+    } else if (rc == READ_TIMEOUT) {
+        snprintf(result, result_size, "[skill timed out after %ds; worker restarted]", config.cmd_timeout);
+        *status = 124;
+    } else {
+        snprintf(result, result_size, "[skill worker exited unexpectedly]");
+        *status = 1;
+    }
+    usage->status = *status;
+    return 0;
+}
+
+void worker_close(void) {
+    for (int i = 0; i < MAX_WORKERS; i++) worker_stop(&workers[i]);
+}